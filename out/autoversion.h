@@ -0,0 +1,4 @@
+
+/* DO NOT EDIT!  This is an autogenerated file.  See scripts/buildversion.py. */
+#define BUILD_VERSION "f264864-dirty-20261018_165306-vm"
+#define BUILD_TOOLS "gcc: (Debian 12.2.0-14+deb12u1) 12.2.0 binutils: (GNU Binutils for Debian) 2.40"
@@ -0,0 +1,41 @@
+#include "src/misc.c"
+ #include "src/stacks.c"
+ #include "src/output.c"
+ #include "src/string.c"
+ #include "src/block.c"
+ #include "src/cdrom.c"
+ #include "src/disk.c"
+ #include "src/mouse.c"
+ #include "src/kbd.c"
+ #include "src/system.c"
+ #include "src/serial.c"
+ #include "src/sercon.c"
+ #include "src/clock.c"
+ #include "src/resume.c"
+ #include "src/pnpbios.c"
+ #include "src/vgahooks.c"
+ #include "src/pcibios.c"
+ #include "src/apm.c"
+ #include "src/cp437.c"
+ #include "src/hw/pci.c"
+ #include "src/hw/timer.c"
+ #include "src/hw/rtc.c"
+ #include "src/hw/dma.c"
+ #include "src/hw/pic.c"
+ #include "src/hw/ps2port.c"
+ #include "src/hw/serialio.c"
+ #include "src/hw/usb.c"
+ #include "src/hw/usb-uhci.c"
+ #include "src/hw/usb-ohci.c"
+ #include "src/hw/usb-ehci.c"
+ #include "src/hw/usb-hid.c"
+ #include "src/hw/usb-msc.c"
+ #include "src/hw/usb-uas.c"
+ #include "src/hw/blockcmd.c"
+ #include "src/hw/floppy.c"
+ #include "src/hw/ata.c"
+ #include "src/hw/ramdisk.c"
+ #include "src/hw/lsi-scsi.c"
+ #include "src/hw/esp-scsi.c"
+ #include "src/hw/megasas.c"
+ #include "src/hw/mpt-scsi.c"
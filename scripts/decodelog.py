@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+# Script to render SeaBIOS binary debug records (CONFIG_DEBUG_RECORDS).
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+
+# Usage:
+#   scripts/decodelog.py out/rom.o debug.log
+#   stty -F /dev/ttyS0 raw; cat /dev/ttyS0 | scripts/decodelog.py out/rom.o
+
+import sys, struct, optparse
+
+# Marker byte starting a binary record (see bvrecord() in src/output.c)
+RECORD_MARK = 0x1e
+# Escape byte inside a record - the next byte is xor'ed with 0x20
+RECORD_ESC = 0x1f
+BUILD_BIOS_ADDR = 0xf0000
+RELOC_FORMAT = b"Relocating init from %p to %p (size %d)\n"
+
+
+######################################################################
+# ELF image access
+######################################################################
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 2
+
+# Load the allocated sections of a 32bit ELF file (normally out/rom.o)
+def loadELF(filename):
+    data = open(filename, 'rb').read()
+    if data[:4] != b'\x7fELF' or data[4] != 1:
+        sys.stderr.write("%s is not a 32bit ELF file\n" % (filename,))
+        sys.exit(1)
+    shoff, = struct.unpack_from('<I', data, 0x20)
+    shentsize, shnum = struct.unpack_from('<HH', data, 0x2e)
+    sections = []
+    for i in range(shnum):
+        (name, sectype, flags, addr, offset, size
+         ) = struct.unpack_from('<IIIIII', data, shoff + i * shentsize)
+        if sectype == SHT_PROGBITS and flags & SHF_ALLOC:
+            sections.append((addr, data[offset:offset+size]))
+    return sections
+
+class Image:
+    def __init__(self, filename):
+        self.sections = loadELF(filename)
+        # Init code relocation (learned from the "Relocating" message)
+        self.relocstart = self.relocend = self.relocdelta = 0
+    def getString(self, addr):
+        if addr >= self.relocstart and addr < self.relocend:
+            addr -= self.relocdelta
+        for secaddr, secdata in self.sections:
+            if addr >= secaddr and addr < secaddr + len(secdata):
+                pos = addr - secaddr
+                end = secdata.find(b'\0', pos)
+                if end < 0:
+                    end = len(secdata)
+                return secdata[pos:end]
+        return None
+
+
+######################################################################
+# Record rendering
+######################################################################
+
+class Record:
+    def __init__(self, infile):
+        self.infile = infile
+    def getByte(self):
+        c = self.infile.read(1)
+        if not c:
+            raise EOFError()
+        return c[0]
+    def getBytes(self, count):
+        data = bytearray()
+        for i in range(count):
+            c = self.getByte()
+            if c == RECORD_ESC:
+                c = self.getByte() ^ 0x20
+            data.append(c)
+        return bytes(data)
+    def getU32(self):
+        return struct.unpack('<I', self.getBytes(4))[0]
+    def getString(self):
+        out = bytearray()
+        while 1:
+            c = self.getBytes(1)
+            if c == b'\0':
+                return bytes(out)
+            out += c
+
+def prettyhex(val, width, padchar, uc):
+    s = "%x" % (val,)
+    if uc:
+        s = s.upper()
+    return padchar * (width - len(s)) + s
+
+# Render a format string the same way bvprintf() in src/output.c does
+def render(fmt, rec):
+    out = []
+    args = []
+    i = 0
+    while i < len(fmt):
+        c = fmt[i:i+1]
+        if c != b'%':
+            out.append(c.decode('latin-1'))
+            i += 1
+            continue
+        n = i + 1
+        fieldwidth = 0
+        padchar = ' '
+        while fmt[n:n+1].isdigit():
+            if not fieldwidth and fmt[n:n+1] == b'0':
+                padchar = '0'
+            else:
+                fieldwidth = fieldwidth * 10 + int(fmt[n:n+1])
+            n += 1
+        is64 = False
+        if fmt[n:n+1] == b'l':
+            n += 1
+        if fmt[n:n+1] == b'l':
+            is64 = True
+            n += 1
+        c = fmt[n:n+1]
+        if c == b'%':
+            out.append('%')
+        elif c in (b'd', b'u'):
+            val = rec.getU32()
+            if is64:
+                rec.getU32()
+            if c == b'd' and val & 0x80000000:
+                val -= 1 << 32
+            out.append("%d" % (val,))
+            args.append(val)
+        elif c in (b'x', b'X'):
+            uc = (c == b'X')
+            val = rec.getU32()
+            upper = 0
+            if is64:
+                upper = rec.getU32()
+            if upper:
+                out.append(prettyhex(upper, fieldwidth - 8, padchar, uc)
+                           + prettyhex(val, 8, '0', uc))
+            else:
+                out.append(prettyhex(val, fieldwidth, padchar, uc))
+            args.append(val | (upper << 32))
+        elif c == b'p':
+            if fmt[n+1:n+2] == b'P':
+                out.append(rec.getString().decode('latin-1'))
+                n += 1
+            else:
+                val = rec.getU32()
+                out.append("0x%08x" % (val,))
+                args.append(val)
+        elif c == b'c':
+            out.append(rec.getBytes(1).decode('latin-1'))
+        elif c == b'.' and fmt[n+1:n+2] == b's':
+            out.append(rec.getString().decode('latin-1'))
+            n += 1
+        elif c == b's':
+            out.append(rec.getString().decode('latin-1'))
+        elif c == b'.':
+            pass
+        else:
+            out.append('%')
+            n = i
+        i = n + 1
+    return ''.join(out), args
+
+def decodeRecord(image, rec):
+    mode = rec.getBytes(1)
+    addr = rec.getU32()
+    if mode == b'S':
+        addr += BUILD_BIOS_ADDR
+    fmt = image.getString(addr)
+    if fmt is None:
+        return "<unknown debug record %s:%08x>\n" % (mode.decode('latin-1')
+                                                     , addr)
+    text, args = render(fmt, rec)
+    if fmt == RELOC_FORMAT:
+        src, dest, size = args
+        image.relocstart, image.relocend = dest, dest + size
+        image.relocdelta = dest - src
+    return text
+
+def decode(image, infile, outfile):
+    rec = Record(infile)
+    try:
+        while 1:
+            c = infile.read(1)
+            if not c:
+                break
+            if c[0] != RECORD_MARK:
+                outfile.write(c.decode('latin-1'))
+            else:
+                outfile.write(decodeRecord(image, rec))
+            if c == b'\n' or c[0] == RECORD_MARK:
+                outfile.flush()
+    except EOFError:
+        outfile.write("<truncated debug record>\n")
+
+
+######################################################################
+# Startup
+######################################################################
+
+def main():
+    usage = "%prog [options] <rom.o> [<logfile>]"
+    opts = optparse.OptionParser(usage)
+    options, args = opts.parse_args()
+    if len(args) not in (1, 2):
+        opts.error("Incorrect number of arguments")
+    image = Image(args[0])
+    infile = sys.stdin.buffer
+    if len(args) > 1:
+        infile = open(args[1], 'rb')
+    decode(image, infile, sys.stdout)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+# Create a chunk compressed disk image for the "hdimg/" and "cdimg/"
+# ramdisk directories (see diskimg_setup() in src/hw/ramdisk.c).
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+
+# Usage:
+#   scripts/diskimg.py rescue.iso rescue.iso.sbdi
+#   cbfstool coreboot.rom add -f rescue.iso.sbdi -n cdimg/rescue -t raw
+
+import sys, struct, optparse
+
+DISKIMG_MAGIC = 0x49444253 # "SBDI"
+HEADER_FORMAT = '<IIIIQ'
+MIN_SHIFT = 11
+MAX_SHIFT = 20
+
+
+######################################################################
+# LZ4 block compression
+######################################################################
+
+MINMATCH = 4
+LASTLITERALS = 5
+MFLIMIT = 12
+MAXOFFSET = 65535
+
+def lz4length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def lz4sequence(out, literals, matchlen, offset):
+    litlen = len(literals)
+    token = min(litlen, 15) << 4
+    if matchlen:
+        token |= min(matchlen - MINMATCH, 15)
+    out.append(token)
+    if litlen >= 15:
+        lz4length(out, litlen - 15)
+    out += literals
+    if matchlen:
+        out += struct.pack('<H', offset)
+        if matchlen - MINMATCH >= 15:
+            lz4length(out, matchlen - MINMATCH - 15)
+
+# Simple greedy compressor producing a raw lz4 block
+def lz4compress(data):
+    try:
+        import lz4.block
+        return lz4.block.compress(bytes(data), mode='high_compression'
+                                  , store_size=False)
+    except ImportError:
+        pass
+    out = bytearray()
+    table = {}
+    size = len(data)
+    anchor = pos = 0
+    while pos < size - MFLIMIT:
+        key = data[pos:pos+MINMATCH]
+        ref = table.get(key)
+        table[key] = pos
+        if ref is None or pos - ref > MAXOFFSET:
+            pos += 1
+            continue
+        matchlen = MINMATCH
+        limit = size - LASTLITERALS
+        while (pos + matchlen < limit
+               and data[ref + matchlen] == data[pos + matchlen]):
+            matchlen += 1
+        lz4sequence(out, data[anchor:pos], matchlen, pos - ref)
+        pos += matchlen
+        anchor = pos
+    lz4sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+######################################################################
+# Image creation
+######################################################################
+
+def buildimage(data, shift):
+    chunksize = 1 << shift
+    count = (len(data) + chunksize - 1) // chunksize
+    chunks = []
+    for i in range(count):
+        chunk = data[i*chunksize:(i+1)*chunksize]
+        if not chunk.strip(b'\0'):
+            # All zeros - nothing to store
+            chunks.append(b'')
+            continue
+        comp = lz4compress(chunk)
+        if len(comp) >= len(chunk):
+            # Not compressible - store as is
+            comp = chunk
+        chunks.append(comp)
+    pos = struct.calcsize(HEADER_FORMAT) + (count + 1) * 4
+    index = []
+    for chunk in chunks:
+        index.append(pos)
+        pos += len(chunk)
+    index.append(pos)
+    header = struct.pack(HEADER_FORMAT, DISKIMG_MAGIC, shift, count, 0
+                         , len(data))
+    return header + struct.pack('<%dI' % (count + 1,), *index) + b''.join(chunks)
+
+def main():
+    usage = "%prog [options] <input image> <output file>"
+    opts = optparse.OptionParser(usage)
+    opts.add_option("-c", "--chunk-size", type="int", dest="chunksize"
+                    , default=65536, help="uncompressed chunk size in bytes")
+    options, args = opts.parse_args()
+    if len(args) != 2:
+        opts.error("Incorrect number of arguments")
+    shift = options.chunksize.bit_length() - 1
+    if (options.chunksize != 1 << shift
+        or shift < MIN_SHIFT or shift > MAX_SHIFT):
+        opts.error("Chunk size must be a power of two between %d and %d"
+                   % (1 << MIN_SHIFT, 1 << MAX_SHIFT))
+    data = open(args[0], 'rb').read()
+    out = buildimage(data, shift)
+    open(args[1], 'wb').write(out)
+    sys.stderr.write("Compressed %d bytes to %d (%d chunks)\n"
+                     % (len(data), len(out)
+                        , (len(data) + (1 << shift) - 1) >> shift))
+
+if __name__ == '__main__':
+    main()
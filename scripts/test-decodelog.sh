@@ -0,0 +1,93 @@
+#!/bin/sh
+# Script to check that binary debug records (CONFIG_DEBUG_RECORDS)
+# survive the serial port.  The code in src/output.c is built for the
+# host as a 32bit freestanding program, its records are sent through
+# the same newline translation as serial_debug_putc(), and the result
+# is decoded with scripts/decodelog.py.
+#
+# Usage:
+#   scripts/test-decodelog.sh
+
+HOSTCC=${HOSTCC:-cc}
+TMPDIR=$(mktemp -d)
+trap 'rm -rf $TMPDIR' EXIT
+
+cat - > $TMPDIR/autoconf.h <<EOF
+#define CONFIG_DEBUG_LEVEL 1
+#define CONFIG_DEBUG_RECORDS 1
+#define CONFIG_DEBUG_RING 0
+#define CONFIG_DEBUG_RING_SIZE 0
+#define CONFIG_DEBUG_SERIAL 0
+#define CONFIG_DEBUG_SERIAL_MMIO 0
+#define CONFIG_DEBUG_COREBOOT 0
+#define CONFIG_DEBUG_IO 0
+#define CONFIG_THREADS 0
+#define CONFIG_COREBOOT 0
+#define CONFIG_VGA_COREBOOT 0
+EOF
+
+cat - > $TMPDIR/test.c <<EOF
+typedef unsigned char u8;
+typedef unsigned int u32;
+
+static void
+sys_write(const void *s, int n)
+{
+    asm volatile("int \$0x80" : : "a"(4), "b"(1), "c"(s), "d"(n) : "memory");
+}
+
+// Replacements for the code used by src/output.c
+char BUILDINFO[1], VERSION[1];
+int ScreenAndDebug;
+void *ZoneTmpHigh, *ZoneTmpLow, *entry_10, *irq_trampoline_0x10;
+void *_malloc(void *zone, u32 size, u32 align) { return 0; }
+void __call16_int(void *regs, unsigned short offset) { }
+void *memset(void *s, int c, unsigned long n)
+{
+    u8 *p = s;
+    while (n--)
+        *p++ = c;
+    return s;
+}
+void coreboot_debug_putc(char c) { }
+void qemu_debug_putc(char c) { }
+void serial_debug_flush(void) { }
+
+// Same newline translation as serial_debug_putc() in src/hw/serialio.c
+void
+serial_debug_putc(char c)
+{
+    if (c == '\n')
+        sys_write("\r", 1);
+    sys_write(&c, 1);
+}
+
+void __dprintf(const char *fmt, ...);
+
+void __attribute__((used))
+realstart(void)
+{
+    __dprintf("int %d %x %s|\n", 10, 0x1f1e0d0a, "a\nb\rc\x1e\x1f");
+    __dprintf("char %c%c 64bit %llx\n", '\n', 0x1e, 0x0a0d1e1f0a0d1e1fULL);
+    __dprintf("stack %.s done\n", "line1\nline2");
+    __dprintf("neg %d\n", -246);
+    asm volatile("int \$0x80" : : "a"(1), "b"(0));
+}
+asm(".globl _start\n_start: call realstart\n");
+EOF
+
+printf 'int 10 1f1e0d0a a\nb\rc\036\037|\nchar \n\036 64bit a0d1e1f0a0d1e1f\nstack line1\nline2 done\nneg -246\n' > $TMPDIR/expect
+
+CFLAGS="-m32 -Os -w -ffreestanding -fno-builtin -fno-pie -fno-stack-protector
+        -fcf-protection=none -DMODE16=0 -DMODESEGMENT=0 -Isrc -I$TMPDIR"
+$HOSTCC $CFLAGS -c src/output.c -o $TMPDIR/output.o || exit 1
+$HOSTCC $CFLAGS -nostdlib -static -no-pie $TMPDIR/test.c $TMPDIR/output.o \
+    -o $TMPDIR/test-decodelog || exit 1
+$TMPDIR/test-decodelog > $TMPDIR/serial.log || exit 1
+scripts/decodelog.py $TMPDIR/test-decodelog $TMPDIR/serial.log > $TMPDIR/out
+if cmp -s $TMPDIR/out $TMPDIR/expect; then
+    echo "serial records: ok"
+else
+    echo "serial records: FAIL"
+    exit 1
+fi
@@ -0,0 +1,145 @@
+#!/bin/sh
+# Script to check the SHA implementations against the FIPS 180 test
+# vectors.  The code in src/sha*.c is built for the host and run once
+# with the scalar code and, if the cpu supports it, once with the x86
+# SHA extensions.
+#
+# Usage:
+#   scripts/test-sha.sh
+
+HOSTCC=${HOSTCC:-cc}
+TMPDIR=$(mktemp -d)
+trap 'rm -rf $TMPDIR' EXIT
+
+cat - > $TMPDIR/autoconf.h <<EOF
+#define CONFIG_TCGBIOS 1
+#define CONFIG_DEBUG_LEVEL 0
+EOF
+
+# Replacements for src/x86.c - the host can't change cr4, so assume SSE
+# is already usable.
+cat - > $TMPDIR/x86.c <<EOF
+#include <cpuid.h>
+void cpuid(unsigned int index, unsigned int *eax, unsigned int *ebx
+           , unsigned int *ecx, unsigned int *edx)
+{
+    __cpuid(index, *eax, *ebx, *ecx, *edx);
+}
+unsigned int sse_enter(void) { return 1; }
+void sse_leave(unsigned int cr4) { }
+EOF
+
+cat - > $TMPDIR/test.c <<EOF
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned char u8;
+typedef unsigned int u32;
+
+void sha1(const u8 *data, u32 length, u8 *hash);
+void sha256(const u8 *data, u32 length, u8 *hash);
+void sha384(const u8 *data, u32 length, u8 *hash);
+void sha512(const u8 *data, u32 length, u8 *hash);
+extern u8 ShaNiPresent, ShaNiUsers;
+
+static const char *vectors[][5] = {
+    { "abc",
+      "a9993e364706816aba3e25717850c26c9cd0d89d",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+      "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+      "8086072ba1e7cc2358baeca134c825a7",
+      "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+      "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+    { "",
+      "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      "38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da"
+      "274edebfe76f65fbd51ad2f14898b95b",
+      "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+      "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+      "3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05abfe8f450de5f36bc6"
+      "b0455a8520bc4e6f5fe95b1fe3c8452b",
+      "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+      "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445" },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+      "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      "a49b2446a02c645bf419f995b67091253a04a259",
+      "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+      "09330c33f71147e83d192fc782cd1b4753111b173b3b05d22fa08086e3b0f712"
+      "fcc7c71a557e2db966c3e9fa91746039",
+      "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+      "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909" },
+    { NULL,
+      "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+      "9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+      "07b8b3dc38ecc4ebae97ddd87f3d8985",
+      "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+      "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+};
+
+static int
+check(const char *name, void (*hash)(const u8 *, u32, u8 *), int hashlen
+      , const u8 *data, u32 length, const char *expect)
+{
+    u8 out[64];
+    char hex[129];
+    int i;
+    hash(data, length, out);
+    for (i = 0; i < hashlen; i++)
+        sprintf(&hex[i*2], "%02x", out[i]);
+    if (strcmp(hex, expect) == 0 && !ShaNiUsers)
+        return 0;
+    printf("%s of %u bytes: got %s expected %s\n", name, length, hex, expect);
+    return 1;
+}
+
+static int
+run(void)
+{
+    static u8 million[1000000];
+    int i, fail = 0;
+    memset(million, 'a', sizeof(million));
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const u8 *data = (const u8 *)vectors[i][0];
+        u32 length = data ? strlen(vectors[i][0]) : sizeof(million);
+        if (!data)
+            data = million;
+        fail |= check("sha1", sha1, 20, data, length, vectors[i][1]);
+        fail |= check("sha256", sha256, 32, data, length, vectors[i][2]);
+        fail |= check("sha384", sha384, 48, data, length, vectors[i][3]);
+        fail |= check("sha512", sha512, 64, data, length, vectors[i][4]);
+    }
+    return fail;
+}
+
+int
+main(void)
+{
+    int fail;
+    ShaNiPresent = 2;
+    fail = run();
+    printf("scalar: %s\n", fail ? "FAIL" : "ok");
+
+    ShaNiPresent = 0;
+    int ret = run();
+    if (ShaNiPresent == 1)
+        printf("sha extensions: %s\n", ret ? "FAIL" : "ok");
+    else
+        printf("sha extensions: not supported by this cpu\n");
+    return fail | ret;
+}
+EOF
+
+CFLAGS="-O2 -w -ffreestanding -fno-builtin -DMODE16=0 -DMODESEGMENT=0
+        -Isrc -I$TMPDIR"
+for f in sha1 sha256 sha512 sha_ni; do
+    $HOSTCC $CFLAGS -c src/$f.c -o $TMPDIR/$f.o || exit 1
+done
+$HOSTCC -O2 $TMPDIR/test.c $TMPDIR/x86.c $TMPDIR/sha1.o $TMPDIR/sha256.o \
+    $TMPDIR/sha512.o $TMPDIR/sha_ni.o -o $TMPDIR/test-sha || exit 1
+$TMPDIR/test-sha
@@ -9,6 +9,7 @@
 #include "block.h" // process_op
 #include "hw/ata.h" // process_ata_op
 #include "hw/ahci.h" // process_ahci_op
+#include "hw/blockcmd.h" // scsi_drive_probe_deferred
 #include "hw/esp-scsi.h" // esp_scsi_process_op
 #include "hw/lsi-scsi.h" // lsi_scsi_process_op
 #include "hw/megasas.h" // megasas_process_op
@@ -23,6 +24,7 @@
 #include "hw/nvme.h" // nvme_process_op
 #include "malloc.h" // malloc_low
 #include "output.h" // dprintf
+#include "romfile.h" // romfile_loadint
 #include "stacks.h" // call32
 #include "std/disk.h" // struct dpte_s
 #include "string.h" // checksum
@@ -261,6 +263,9 @@ map_hd_drive(struct drive_s *drive)
     int hdid = bda->hdcount;
     dprintf(3, "Mapping hd drive %p to %d\n", drive, hdid);
     add_drive(IDMap[EXTTYPE_HD], &bda->hdcount, drive);
+    if (drive->deferred)
+        // Geometry is setup by block_probe_deferred()
+        return;
 
     // Setup disk geometry translation.
     setup_translation(drive);
@@ -504,9 +509,12 @@ fill_edd(struct segoff_s edd, struct drive_s *drive_fl)
  * Disk driver dispatch
  ****************************************************************/
 
+int LazyDriveProbe;
+
 void
 block_setup(void)
 {
+    LazyDriveProbe = romfile_loadint("etc/lazy-drive-probe", 0);
     floppy_setup();
     ata_setup();
     ahci_setup();
@@ -522,6 +530,25 @@ block_setup(void)
     nvme_setup();
 }
 
+// Complete the setup of a drive registered without a full probe (see
+// scsi_drive_setup()) - called on the first access to the drive.
+int VISIBLE32FLAT
+block_probe_deferred(struct drive_s *drive)
+{
+    ASSERT32FLAT();
+    if (!drive->deferred)
+        return 0;
+    drive->deferred = 0;
+    dprintf(3, "Probing deferred drive %p\n", drive);
+    int ret = scsi_drive_probe_deferred(drive);
+    int hdid = getDriveId(EXTTYPE_HD, drive);
+    if (hdid >= 0) {
+        setup_translation(drive);
+        fill_fdpt(drive, hdid);
+    }
+    return ret;
+}
+
 // Fallback handler for command requests not implemented by drivers
 int
 default_process_op(struct disk_op_s *op)
@@ -591,6 +618,9 @@ process_op_32(struct disk_op_s *op)
         return pvscsi_process_op(op);
     case DTYPE_NVME:
         return nvme_process_op(op);
+    case DTYPE_RAMDISK:
+    case DTYPE_RAMDISK_32:
+        return ramdisk_process_op(op);
     default:
         return process_op_both(op);
     }
@@ -623,6 +653,9 @@ process_op(struct disk_op_s *op)
             , op->drive_fl, (u32)op->lba, op->buf_fl
             , op->count, op->command);
 
+    if (!MODESEGMENT && op->drive_fl->deferred)
+        block_probe_deferred(op->drive_fl);
+
     int ret, origcount = op->count;
     if (origcount * GET_FLATPTR(op->drive_fl->blksize) > 64*1024) {
         op->count = 0;
@@ -52,6 +52,7 @@ struct drive_s {
     u64 sectors;        // Total sectors count
     u32 cntl_id;        // Unique id for a given driver type.
     u8 removable;       // Is media removable (currently unused)
+    u8 deferred;        // Full probe deferred until first access
 
     // Info for EDD calls
     u8 translation;     // type of translation
@@ -69,6 +70,7 @@ struct drive_s {
 #define DTYPE_ATA          0x20
 #define DTYPE_ATA_ATAPI    0x21
 #define DTYPE_RAMDISK      0x30
+#define DTYPE_RAMDISK_32   0x31
 #define DTYPE_CDEMU        0x40
 #define DTYPE_AHCI         0x50
 #define DTYPE_AHCI_ATAPI   0x51
@@ -109,6 +111,7 @@ struct drive_s {
 // block.c
 extern u8 FloppyCount, CDCount;
 extern u8 *bounce_buf_fl;
+extern int LazyDriveProbe;
 struct drive_s *getDrive(u8 exttype, u8 extdriveoffset);
 int getDriveId(u8 exttype, struct drive_s *drive);
 void map_floppy_drive(struct drive_s *drive);
@@ -117,7 +120,9 @@ void map_cd_drive(struct drive_s *drive);
 struct int13dpt_s;
 int fill_edd(struct segoff_s edd, struct drive_s *drive_fl);
 void block_setup(void);
+int block_probe_deferred(struct drive_s *drive);
 int default_process_op(struct disk_op_s *op);
+int process_op_32(struct disk_op_s *op);
 int process_op(struct disk_op_s *op);
 int create_bounce_buf(void);
 
@@ -295,6 +295,12 @@ find_prio(const char *glob)
     return -1;
 }
 
+// Check if a bootorder file was provided.
+int bootorder_present(void)
+{
+    return BootorderCount > 0;
+}
+
 u8 is_bootprio_strict(void)
 {
     static int prio_halt = -2;
@@ -419,6 +425,17 @@ build_usb_path(char *buf, int max, struct usbhub_s *hub)
     return p;
 }
 
+static char *
+build_usb_cntl_path(char *buf, int max, struct usbdevice_s *usbdev)
+{
+    if (usbdev->hub->cntl->pci)
+        return build_pci_path(buf, max, "usb", usbdev->hub->cntl->pci);
+    if (usbdev->hub->cntl->mmio)
+        return buf + snprintf(buf, max, "/*@%016x"
+                              , (u32)usbdev->hub->cntl->mmio);
+    return NULL;
+}
+
 int bootprio_find_usb(struct usbdevice_s *usbdev, int lun)
 {
     if (!CONFIG_BOOTORDER)
@@ -428,12 +445,8 @@ int bootprio_find_usb(struct usbdevice_s *usbdev, int lun)
     //   mmio: /sysbus-xhci@00000000fe900000/storage@1/channel@0/disk@0,0
     char desc[256], *p;
 
-    if (usbdev->hub->cntl->pci)
-        p = build_pci_path(desc, sizeof(desc), "usb", usbdev->hub->cntl->pci);
-    else if (usbdev->hub->cntl->mmio)
-        p = desc + snprintf(desc, sizeof(desc), "/*@%016x"
-                            , (u32)usbdev->hub->cntl->mmio);
-    else
+    p = build_usb_cntl_path(desc, sizeof(desc), usbdev);
+    if (!p)
         return -1;
 
     p = build_usb_path(p, desc+sizeof(desc)-p, usbdev->hub);
@@ -447,6 +460,19 @@ int bootprio_find_usb(struct usbdevice_s *usbdev, int lun)
     return find_prio(desc);
 }
 
+// Build a topology path for a usb device - for example:
+//   /pci@i0cf8/usb@1,2/hub@1/usb-*@3
+char *
+build_usbdev_path(char *buf, int max, struct usbdevice_s *usbdev)
+{
+    char *p = build_usb_cntl_path(buf, max, usbdev);
+    if (!p)
+        return NULL;
+    p = build_usb_path(p, buf+max-p, usbdev->hub);
+    p += snprintf(p, buf+max-p, "/usb-*@%x", usb_portmap(usbdev));
+    return p;
+}
+
 
 /****************************************************************
  * Boot setup
@@ -52,32 +52,40 @@ enable_vga_console(void)
     display_uuid();
 }
 
+static int
+get_modeinfo(int videomode, struct vbe_mode_info *mode_info)
+{
+    struct bregs br;
+    memset(&br, 0, sizeof(br));
+    br.ax = 0x4f01;
+    br.cx = videomode;
+    br.di = FLATPTR_TO_OFFSET(mode_info);
+    br.es = FLATPTR_TO_SEG(mode_info);
+    call16_int10(&br);
+    if (br.ax != 0x4f) {
+        dprintf(1, "get_mode failed.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Find the vesa mode best suited to show an image.  The image may be
+// centred in a larger mode or downscaled by up to 1/(1<<maxscale) to fit
+// a smaller one.  The mode needing the least downscaling is used, and of
+// those the smallest mode (so an exact match is always preferred).
 static int
 find_videomode(struct vbe_info *vesa_info, struct vbe_mode_info *mode_info
-               , int width, int height, int bpp_req)
+               , int width, int height, int bpp_req, int maxscale)
 {
     dprintf(3, "Finding vesa mode with dimensions %d/%d\n", width, height);
     u16 *videomodes = SEGOFF_TO_FLATPTR(vesa_info->video_mode);
+    int bestmode = -1, bestscale = maxscale + 1;
+    u32 bestarea = 0;
     for (;; videomodes++) {
         u16 videomode = *videomodes;
-        if (videomode == 0xffff) {
-            dprintf(1, "Unable to find vesa video mode dimensions %d/%d\n"
-                    , width, height);
-            return -1;
-        }
-        struct bregs br;
-        memset(&br, 0, sizeof(br));
-        br.ax = 0x4f01;
-        br.cx = videomode;
-        br.di = FLATPTR_TO_OFFSET(mode_info);
-        br.es = FLATPTR_TO_SEG(mode_info);
-        call16_int10(&br);
-        if (br.ax != 0x4f) {
-            dprintf(1, "get_mode failed.\n");
-            continue;
-        }
-        if (mode_info->xres != width
-            || mode_info->yres != height)
+        if (videomode == 0xffff)
+            break;
+        if (get_modeinfo(videomode, mode_info))
             continue;
         u8 depth = mode_info->bits_per_pixel;
         if (bpp_req == 0) {
@@ -88,8 +96,45 @@ find_videomode(struct vbe_info *vesa_info, struct vbe_mode_info *mode_info
             if (depth != bpp_req)
                 continue;
         }
-        return videomode;
+        int scale;
+        for (scale = 0; scale <= maxscale; scale++)
+            if ((width >> scale) <= mode_info->xres
+                && (height >> scale) <= mode_info->yres)
+                break;
+        u32 area = mode_info->xres * mode_info->yres;
+        if (scale < bestscale || (scale == bestscale && area < bestarea)) {
+            bestmode = videomode;
+            bestscale = scale;
+            bestarea = area;
+        }
+    }
+    if (bestmode < 0) {
+        dprintf(1, "Unable to find vesa video mode dimensions %d/%d\n"
+                , width, height);
+        return -1;
+    }
+    if (get_modeinfo(bestmode, mode_info))
+        return -1;
+    if (bestscale)
+        dprintf(3, "Downscaling bootsplash by 1/%d\n", 1 << bestscale);
+    return bestmode;
+}
+
+// Switch to the given vesa graphics mode with a linear framebuffer.
+static int
+set_videomode(int videomode)
+{
+    dprintf(5, "Switching to graphics mode\n");
+    struct bregs br;
+    memset(&br, 0, sizeof(br));
+    br.ax = 0x4f02;
+    br.bx = videomode | VBE_MODE_LINEAR_FRAME_BUFFER;
+    call16_int10(&br);
+    if (br.ax != 0x4f) {
+        dprintf(1, "set_mode failed.\n");
+        return -1;
     }
+    return 0;
 }
 
 static int BootsplashActive;
@@ -177,9 +222,10 @@ enable_bootsplash(void)
 
     // jpeg would use 16 or 24 bpp video mode, BMP uses 16/24/32 bpp mode.
 
-    // Try to find a graphics mode with the corresponding dimensions.
+    // Try to find a graphics mode that can show the image.  Only jpeg
+    // images can be downscaled to fit a smaller mode.
     int videomode = find_videomode(vesa_info, mode_info, width, height,
-                                       bpp_require);
+                                   bpp_require, type == 0 ? 3 : 0);
     if (videomode < 0) {
         dprintf(1, "failed to find a videomode with %dx%d %dbpp (0=any).\n",
                     width, height, bpp_require);
@@ -192,43 +238,47 @@ enable_bootsplash(void)
     dprintf(3, "bytes per scanline: %d\n", mode_info->bytes_per_scanline);
     dprintf(3, "bits per pixel: %d\n", depth);
 
-    // Allocate space for image and decompress it.
-    int imagesize = height * mode_info->bytes_per_scanline;
-    picture = malloc_tmphigh(imagesize);
-    if (!picture) {
-        warn_noalloc();
-        goto done;
-    }
-
     if (type == 0) {
+        // Decode the jpeg directly into the framebuffer.
+        ret = set_videomode(videomode);
+        if (ret)
+            goto done;
         dprintf(5, "Decompressing bootsplash.jpg\n");
-        ret = jpeg_show(jpeg, picture, width, height, depth,
-                            mode_info->bytes_per_scanline);
+        ret = jpeg_show(jpeg, framebuffer, mode_info->xres, mode_info->yres,
+                        depth, mode_info->bytes_per_scanline);
         if (ret) {
             dprintf(1, "jpeg_show failed with return code %d...\n", ret);
+            enable_vga_console();
             goto done;
         }
-    } else {
-        dprintf(5, "Decompressing bootsplash.bmp\n");
-        ret = bmp_show(bmp, picture, width, height, depth,
-                           mode_info->bytes_per_scanline);
-        if (ret) {
-            dprintf(1, "bmp_show failed with return code %d...\n", ret);
-            goto done;
-        }
+        dprintf(5, "Bootsplash decode complete\n");
+        BootsplashActive = 1;
+        goto done;
     }
 
-    /* Switch to graphics mode */
-    dprintf(5, "Switching to graphics mode\n");
-    memset(&br, 0, sizeof(br));
-    br.ax = 0x4f02;
-    br.bx = videomode | VBE_MODE_LINEAR_FRAME_BUFFER;
-    call16_int10(&br);
-    if (br.ax != 0x4f) {
-        dprintf(1, "set_mode failed.\n");
+    // Allocate space for image and decompress it centred on the screen.
+    int bpl = mode_info->bytes_per_scanline;
+    int imagesize = mode_info->yres * bpl;
+    picture = malloc_tmphigh(imagesize);
+    if (!picture) {
+        warn_noalloc();
+        goto done;
+    }
+    memset(picture, 0, imagesize);
+
+    dprintf(5, "Decompressing bootsplash.bmp\n");
+    ret = bmp_show(bmp, picture + (mode_info->yres - height) / 2 * bpl
+                   + (mode_info->xres - width) / 2 * depth / 8
+                   , width, height, depth, bpl);
+    if (ret) {
+        dprintf(1, "bmp_show failed with return code %d...\n", ret);
         goto done;
     }
 
+    ret = set_videomode(videomode);
+    if (ret)
+        goto done;
+
     /* Show the picture */
     dprintf(5, "Showing bootsplash picture\n");
     iomemcpy(framebuffer, picture, imagesize);
@@ -26,6 +26,41 @@ struct eltorito_s CDEmu VARLOW = { .size=sizeof(CDEmu) };
 struct drive_s *emulated_drive_gf VARLOW;
 struct drive_s *cdemu_drive_gf VARFSEG;
 
+// Cache of recently read cdrom sectors (used for partial sector reads)
+#define CDEMU_CACHE_SECTORS 4
+u8 *cdemu_cache_fl VARFSEG;
+u32 cdemu_cache_lba VARLOW;
+u8 cdemu_cache_count VARLOW;
+
+// Copy part of a cdrom sector to 'buf_fl' - reading the sector (and
+// the following sectors) into the sector cache if not already present.
+static int
+cdemu_read_partial(struct disk_op_s *dop, void *buf_fl, int offset, int count)
+{
+    u8 *cache_fl = GET_GLOBAL(cdemu_cache_fl);
+    u32 lba = dop->lba, first = GET_LOW(cdemu_cache_lba);
+    if (lba < first || lba - first >= GET_LOW(cdemu_cache_count)) {
+        // Cache miss - read ahead into the cache.
+        SET_LOW(cdemu_cache_count, 0);
+        dop->count = CDEMU_CACHE_SECTORS;
+        dop->buf_fl = cache_fl;
+        int ret = process_op(dop);
+        if (ret) {
+            // Possibly at the end of the disc - try a single sector.
+            dop->count = 1;
+            ret = process_op(dop);
+            if (ret)
+                return ret;
+        }
+        SET_LOW(cdemu_cache_lba, lba);
+        SET_LOW(cdemu_cache_count, dop->count);
+        first = lba;
+    }
+    u8 *sector_fl = cache_fl + (lba - first) * CDROM_SECTOR_SIZE;
+    memcpy_fl(buf_fl, sector_fl + offset * 512, count * 512);
+    return DISK_RET_SUCCESS;
+}
+
 static int
 cdemu_read(struct disk_op_s *op)
 {
@@ -37,20 +72,16 @@ cdemu_read(struct disk_op_s *op)
 
     int count = op->count;
     op->count = 0;
-    u8 *cdbuf_fl = GET_GLOBAL(bounce_buf_fl);
 
     if (op->lba & 3) {
         // Partial read of first block.
-        dop.count = 1;
-        dop.buf_fl = cdbuf_fl;
-        int ret = process_op(&dop);
-        if (ret)
-            return ret;
         u8 thiscount = 4 - (op->lba & 3);
         if (thiscount > count)
             thiscount = count;
+        int ret = cdemu_read_partial(&dop, op->buf_fl, op->lba & 3, thiscount);
+        if (ret)
+            return ret;
         count -= thiscount;
-        memcpy_fl(op->buf_fl, cdbuf_fl + (op->lba & 3) * 512, thiscount * 512);
         op->buf_fl += thiscount * 512;
         op->count += thiscount;
         dop.lba++;
@@ -72,14 +103,10 @@ cdemu_read(struct disk_op_s *op)
 
     if (count) {
         // Partial read on last block.
-        dop.count = 1;
-        dop.buf_fl = cdbuf_fl;
-        int ret = process_op(&dop);
+        int ret = cdemu_read_partial(&dop, op->buf_fl, 0, count);
         if (ret)
             return ret;
-        u8 thiscount = count;
-        memcpy_fl(op->buf_fl, cdbuf_fl, thiscount * 512);
-        op->count += thiscount;
+        op->count += count;
     }
 
     return DISK_RET_SUCCESS;
@@ -109,14 +136,16 @@ cdrom_prepboot(void)
         return;
     if (!CDCount)
         return;
-    if (create_bounce_buf() < 0)
-        return;
 
     struct drive_s *drive = malloc_fseg(sizeof(*drive));
-    if (!drive) {
+    u8 *cache = malloc_low(CDEMU_CACHE_SECTORS * CDROM_SECTOR_SIZE);
+    if (!drive || !cache) {
         warn_noalloc();
+        free(drive);
+        free(cache);
         return;
     }
+    cdemu_cache_fl = cache;
     cdemu_drive_gf = drive;
     memset(drive, 0, sizeof(*drive));
     drive->type = DTYPE_CDEMU;
@@ -189,6 +218,7 @@ cdrom_boot(struct drive_s *drive)
 
     // Fill in el-torito cdrom emulation fields.
     emulated_drive_gf = drive;
+    cdemu_cache_count = 0;
     u8 media = buffer[0x21];
 
     u16 boot_segment = *(u16*)&buffer[0x22];
@@ -721,6 +721,8 @@ handle_legacy_disk(struct bregs *regs, u8 extdrive)
         drive_fl = getDrive(EXTTYPE_HD, extdrive - EXTSTART_HD);
     if (!drive_fl)
         goto fail;
+    if (GET_FLATPTR(drive_fl->deferred))
+        call32(block_probe_deferred, (u32)drive_fl, -1);
     disk_13(regs, drive_fl);
     return;
 
@@ -9,6 +9,7 @@
 #include "config.h" // CONFIG_*
 #include "e820map.h" // e820_add
 #include "hw/pcidevice.h" // pci_probe_devices
+#include "lz4decode.h" // lz4f_decompress
 #include "lzmadecode.h" // LzmaDecode
 #include "malloc.h" // free
 #include "output.h" // dprintf
@@ -278,17 +279,72 @@ coreboot_platform_setup(void)
  * ulzma
  ****************************************************************/
 
+// Amount of data to uncompress between calls to the chunk callback
+#define LZMA_CHUNK_SIZE (64*1024)
+
+// Callback invoked with each newly uncompressed chunk of data (eg, to
+// let other threads run or to hash the data while it is in the cache).
+typedef void (*ulzma_chunk_fn)(void *data, const u8 *buf, u32 len);
+
+// Read the lzma header and return the uncompressed size.
+static int
+ulzma_header(CLzmaDecoderState *state, u32 maxlen, const u8 *src, u32 srclen)
+{
+    if (srclen < LZMA_PROPERTIES_SIZE + 8)
+        return -1;
+    int ret = LzmaDecodeProperties(&state->Properties, src
+                                   , LZMA_PROPERTIES_SIZE);
+    if (ret != LZMA_RESULT_OK) {
+        dprintf(1, "LzmaDecodeProperties error - %d\n", ret);
+        return -1;
+    }
+    u32 dstlen = *(u32*)(src + LZMA_PROPERTIES_SIZE);
+    if (dstlen > maxlen) {
+        dprintf(1, "LzmaDecode too large (max %d need %d)\n", maxlen, dstlen);
+        return -1;
+    }
+    return dstlen;
+}
+
+// Uncompress data directly to its destination in chunks, passing each
+// chunk to 'chunk' (if set).
+static int
+ulzma_decode(CLzmaDecoderState *state, u8 *dst, u32 dstlen
+             , const u8 *src, u32 srclen, ulzma_chunk_fn chunk, void *data)
+{
+    int ret = LzmaDecoderInit(state, src + LZMA_PROPERTIES_SIZE + 8
+                              , srclen - LZMA_PROPERTIES_SIZE - 8);
+    u32 pos = 0;
+    while (!ret && pos < dstlen) {
+        u32 end = pos + LZMA_CHUNK_SIZE;
+        if (end > dstlen)
+            end = dstlen;
+        ret = LzmaDecode(state, dst, end);
+        if (ret)
+            break;
+        if (chunk)
+            chunk(data, dst + pos, state->NowPos - pos);
+        if (state->NowPos < end)
+            // End of stream marker
+            break;
+        pos = end;
+    }
+    if (ret) {
+        dprintf(1, "LzmaDecode returned %d\n", ret);
+        return -1;
+    }
+    return dstlen;
+}
+
 // Uncompress data in flash to an area of memory.
 static int
 ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen)
 {
     dprintf(3, "Uncompressing data %d@%p to %d@%p\n", srclen, src, maxlen, dst);
     CLzmaDecoderState state;
-    int ret = LzmaDecodeProperties(&state.Properties, src, LZMA_PROPERTIES_SIZE);
-    if (ret != LZMA_RESULT_OK) {
-        dprintf(1, "LzmaDecodeProperties error - %d\n", ret);
+    int dstlen = ulzma_header(&state, maxlen, src, srclen);
+    if (dstlen < 0)
         return -1;
-    }
     u8 scratch[15980];
     int need = (LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
     if (need > sizeof(scratch)) {
@@ -296,20 +352,36 @@ ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen)
         return -1;
     }
     state.Probs = (CProb *)scratch;
+    return ulzma_decode(&state, dst, dstlen, src, srclen, NULL, NULL);
+}
 
-    u32 dstlen = *(u32*)(src + LZMA_PROPERTIES_SIZE);
-    if (dstlen > maxlen) {
-        dprintf(1, "LzmaDecode too large (max %d need %d)\n", maxlen, dstlen);
+// Chunk callback that lets other threads run between chunks.
+static void
+ulzma_yield(void *data, const u8 *buf, u32 len)
+{
+    yield();
+}
+
+// Uncompress data using an allocated probability buffer (supports all
+// lc/lp settings, but only available during POST).
+static int
+ulzma_alloc(u8 *dst, u32 maxlen, const u8 *src, u32 srclen
+            , ulzma_chunk_fn chunk, void *data)
+{
+    dprintf(3, "Uncompressing data %d@%p to %d@%p\n", srclen, src, maxlen, dst);
+    CLzmaDecoderState state;
+    int dstlen = ulzma_header(&state, maxlen, src, srclen);
+    if (dstlen < 0)
         return -1;
-    }
-    u32 inProcessed, outProcessed;
-    ret = LzmaDecode(&state, src + LZMA_PROPERTIES_SIZE + 8, srclen
-                     , &inProcessed, dst, dstlen, &outProcessed);
-    if (ret) {
-        dprintf(1, "LzmaDecode returned %d\n", ret);
+    state.Probs = malloc_tmphigh(LzmaGetNumProbs(&state.Properties)
+                                 * sizeof(CProb));
+    if (!state.Probs) {
+        warn_noalloc();
         return -1;
     }
-    return dstlen;
+    int ret = ulzma_decode(&state, dst, dstlen, src, srclen, chunk, data);
+    free(state.Probs);
+    return ret;
 }
 
 
@@ -332,6 +404,10 @@ struct cbfs_header {
 
 #define CBFS_FILE_MAGIC 0x455649484352414cLL // LARCHIVE
 
+#define CBFS_COMPRESS_NONE  0
+#define CBFS_COMPRESS_LZMA  1
+#define CBFS_COMPRESS_LZ4   2
+
 struct cbfs_file {
     u64 magic;
     u32 len;
@@ -345,7 +421,7 @@ struct cbfs_romfile_s {
     struct romfile_s file;
     struct cbfs_file *fhdr;
     void *data;
-    u32 rawsize, flags;
+    u32 rawsize, compression;
 };
 
 // Copy a file to memory (uncompressing if necessary)
@@ -359,7 +435,7 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
     cfile = container_of(file, struct cbfs_romfile_s, file);
     u32 size = cfile->rawsize;
     void *src = cfile->data;
-    if (cfile->flags) {
+    if (cfile->compression != CBFS_COMPRESS_NONE) {
         // Compressed - copy to temp ram and uncompress it.
         void *temp = malloc_tmphigh(size);
         if (!temp) {
@@ -367,7 +443,11 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
             return -1;
         }
         iomemcpy(temp, src, size);
-        int ret = ulzma(dst, maxlen, temp, size);
+        int ret;
+        if (cfile->compression == CBFS_COMPRESS_LZ4)
+            ret = lz4f_decompress(dst, maxlen, temp, size);
+        else
+            ret = ulzma_alloc(dst, maxlen, temp, size, ulzma_yield, NULL);
         yield();
         free(temp);
         return ret;
@@ -383,6 +463,20 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
     return size;
 }
 
+// Return the flash address of an uncompressed CBFS file (or NULL if
+// the file is not a directly mapped CBFS file).
+void *
+cbfs_romfile_map(struct romfile_s *file)
+{
+    if (!CONFIG_COREBOOT_FLASH || file->copy != cbfs_copyfile)
+        return NULL;
+    struct cbfs_romfile_s *cfile;
+    cfile = container_of(file, struct cbfs_romfile_s, file);
+    if (cfile->compression != CBFS_COMPRESS_NONE)
+        return NULL;
+    return cfile->data;
+}
+
 // Process CBFS links file.  The links file is a newline separated
 // file where each line has a "link name" and a "destination name"
 // separated by a space character.
@@ -465,11 +559,23 @@ coreboot_cbfs_init(void)
         cfile->file.copy = cbfs_copyfile;
         cfile->data = (void*)fhdr + be32_to_cpu(fhdr->offset);
         int len = strlen(cfile->file.name);
-        if (len > 5 && strcmp(&cfile->file.name[len-5], ".lzma") == 0) {
+        if (CONFIG_LZMA
+            && len > 5 && strcmp(&cfile->file.name[len-5], ".lzma") == 0) {
             // Using compression.
-            cfile->flags = 1;
+            cfile->compression = CBFS_COMPRESS_LZMA;
             cfile->file.name[len-5] = '\0';
             cfile->file.size = *(u32*)(cfile->data + LZMA_PROPERTIES_SIZE);
+        } else if (CONFIG_LZ4
+                   && len > 4 && strcmp(&cfile->file.name[len-4], ".lz4") == 0) {
+            int size = lz4f_content_size(cfile->data, cfile->rawsize);
+            if (size < 0) {
+                dprintf(1, "CBFS file %s has no lz4 content size\n"
+                        , cfile->file.name);
+            } else {
+                cfile->compression = CBFS_COMPRESS_LZ4;
+                cfile->file.name[len-4] = '\0';
+                cfile->file.size = size;
+            }
         }
         romfile_add(&cfile->file);
 
@@ -492,9 +598,6 @@ struct cbfs_payload_segment {
 #define PAYLOAD_SEGMENT_BSS    0x20535342
 #define PAYLOAD_SEGMENT_ENTRY  0x52544E45
 
-#define CBFS_COMPRESS_NONE  0
-#define CBFS_COMPRESS_LZMA  1
-
 struct cbfs_payload {
     struct cbfs_payload_segment segments[1];
 };
@@ -536,6 +639,12 @@ cbfs_run_payload(struct cbfs_file *fhdr)
                 if (ret < 0)
                     return;
                 src_len = ret;
+            } else if (CONFIG_LZ4
+                       && seg->compression == cpu_to_be32(CBFS_COMPRESS_LZ4)) {
+                int ret = lz4f_decompress(dest, dest_len, src, src_len);
+                if (ret < 0)
+                    return;
+                src_len = ret;
             } else {
                 dprintf(1, "No support for compression type %x\n"
                         , seg->compression);
@@ -0,0 +1,196 @@
+// LZ4 decompression (frame and block formats)
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+//
+//  See: https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+//       https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+#include "lz4decode.h" // lz4f_decompress
+#include "output.h" // dprintf
+#include "string.h" // memcpy
+
+
+/****************************************************************
+ * Block format
+ ****************************************************************/
+
+// Read an extended length (a series of bytes terminated by a non-255 byte)
+static int
+lz4_getlen(const u8 **psp, const u8 *send, u32 len)
+{
+    const u8 *sp = *psp;
+    u8 b;
+    do {
+        if (sp >= send)
+            return -1;
+        b = *sp++;
+        len += b;
+    } while (b == 255);
+    *psp = sp;
+    return len;
+}
+
+// Decode one block to 'dp'.  Matches may reference any data written
+// since 'base' (allowing linked blocks of a frame).  Returns the
+// number of bytes written or -1 on error.
+static int
+lz4_block(u8 *base, u8 *dp, u8 *dend, const u8 *sp, const u8 *send)
+{
+    u8 *start = dp;
+    while (sp < send) {
+        u8 token = *sp++;
+
+        // Literals
+        int len = token >> 4;
+        if (len == 15) {
+            len = lz4_getlen(&sp, send, len);
+            if (len < 0)
+                return -1;
+        }
+        if (len > send - sp || len > dend - dp)
+            return -1;
+        memcpy(dp, sp, len);
+        dp += len;
+        sp += len;
+        if (sp >= send)
+            // The last sequence has no match
+            break;
+
+        // Match
+        if (send - sp < 2)
+            return -1;
+        u32 offset = sp[0] | (sp[1] << 8);
+        sp += 2;
+        if (!offset || offset > dp - base)
+            return -1;
+        len = token & 0x0f;
+        if (len == 15) {
+            len = lz4_getlen(&sp, send, len);
+            if (len < 0)
+                return -1;
+        }
+        len += 4;
+        if (len > dend - dp)
+            return -1;
+        const u8 *mp = dp - offset;
+        if (offset >= len) {
+            memcpy(dp, mp, len);
+            dp += len;
+        } else {
+            // Overlapping match (repeating pattern)
+            while (len--)
+                *dp++ = *mp++;
+        }
+    }
+    return dp - start;
+}
+
+// Uncompress a raw lz4 block.  Returns the uncompressed size or -1.
+int
+lz4_decompress_block(void *dst, u32 maxlen, const void *src, u32 srclen)
+{
+    return lz4_block(dst, dst, dst + maxlen, src, src + srclen);
+}
+
+
+/****************************************************************
+ * Frame format
+ ****************************************************************/
+
+#define LZ4F_FLG_VERSION_MASK  0xc0
+#define LZ4F_FLG_VERSION       0x40
+#define LZ4F_FLG_BLOCK_CSUM    0x10
+#define LZ4F_FLG_CONTENT_SIZE  0x08
+#define LZ4F_FLG_CONTENT_CSUM  0x04
+#define LZ4F_FLG_DICTID        0x01
+
+#define LZ4F_BLOCK_UNCOMPRESSED 0x80000000
+
+// Parse the frame header.  Returns the header length or -1 on error.
+static int
+lz4f_header(const u8 *src, u32 srclen, u8 *pflg, u64 *psize)
+{
+    if (srclen < 7 || *(u32*)src != LZ4F_MAGIC)
+        return -1;
+    u8 flg = src[4];
+    if ((flg & LZ4F_FLG_VERSION_MASK) != LZ4F_FLG_VERSION) {
+        dprintf(1, "lz4: unsupported frame version (flg=%x)\n", flg);
+        return -1;
+    }
+    int hdrlen = 7;
+    if (flg & LZ4F_FLG_CONTENT_SIZE)
+        hdrlen += 8;
+    if (flg & LZ4F_FLG_DICTID) {
+        dprintf(1, "lz4: preset dictionaries not supported\n");
+        return -1;
+    }
+    if (srclen < hdrlen)
+        return -1;
+    *pflg = flg;
+    *psize = 0;
+    if (flg & LZ4F_FLG_CONTENT_SIZE)
+        *psize = *(u64*)&src[6];
+    return hdrlen;
+}
+
+// Return the uncompressed size stored in an lz4 frame header (or -1
+// if the frame does not record it).
+int
+lz4f_content_size(const void *src, u32 srclen)
+{
+    u8 flg;
+    u64 size;
+    int hdrlen = lz4f_header(src, srclen, &flg, &size);
+    if (hdrlen < 0 || !(flg & LZ4F_FLG_CONTENT_SIZE) || size > 0x7fffffff)
+        return -1;
+    return size;
+}
+
+// Uncompress an lz4 frame.  Returns the uncompressed size or -1 on error.
+int
+lz4f_decompress(void *dst, u32 maxlen, const void *src, u32 srclen)
+{
+    u8 flg;
+    u64 size;
+    int hdrlen = lz4f_header(src, srclen, &flg, &size);
+    if (hdrlen < 0) {
+        dprintf(1, "lz4: invalid frame header\n");
+        return -1;
+    }
+    if ((flg & LZ4F_FLG_CONTENT_SIZE) && size > maxlen) {
+        dprintf(1, "lz4: too large (max %d need %d)\n", maxlen, (u32)size);
+        return -1;
+    }
+    const u8 *sp = src + hdrlen, *send = src + srclen;
+    u8 *dp = dst, *dend = dst + maxlen;
+    for (;;) {
+        if (send - sp < 4)
+            goto fail;
+        u32 blocksize = *(u32*)sp;
+        sp += 4;
+        if (!blocksize)
+            // End mark (content checksum, if any, is not verified)
+            break;
+        u32 len = blocksize & ~LZ4F_BLOCK_UNCOMPRESSED;
+        if (len > send - sp)
+            goto fail;
+        if (blocksize & LZ4F_BLOCK_UNCOMPRESSED) {
+            if (len > dend - dp)
+                goto fail;
+            memcpy(dp, sp, len);
+            dp += len;
+        } else {
+            int ret = lz4_block(dst, dp, dend, sp, sp + len);
+            if (ret < 0)
+                goto fail;
+            dp += ret;
+        }
+        sp += len;
+        if (flg & LZ4F_FLG_BLOCK_CSUM)
+            sp += 4;
+    }
+    return dp - (u8*)dst;
+fail:
+    dprintf(1, "lz4: corrupt data at offset %d\n", sp - (u8*)src);
+    return -1;
+}
@@ -0,0 +1,13 @@
+#ifndef __LZ4DECODE_H
+#define __LZ4DECODE_H
+
+#include "types.h" // u32
+
+#define LZ4F_MAGIC 0x184D2204
+
+// lz4decode.c
+int lz4f_content_size(const void *src, u32 srclen);
+int lz4f_decompress(void *dst, u32 maxlen, const void *src, u32 srclen);
+int lz4_decompress_block(void *dst, u32 maxlen, const void *src, u32 srclen);
+
+#endif // lz4decode.h
@@ -51,6 +51,21 @@
   
 #define RC_GET_BIT(p, mi) RC_GET_BIT2(p, mi, ; , ;)               
 
+/* Adding (kBitModelTotal - ttt) >> kNumMoveBits (the update for a 0 bit)
+   is the same as subtracting (ttt - kBitModelNB) >> kNumMoveBits using
+   an arithmetic shift, so both updates can share one expression. */
+#define kBitModelNB (kBitModelTotal - (1 << kNumMoveBits) + 1)
+
+/* Decode a bit without branching on its value - the bits of literals
+   are hard to predict and mispredicted branches dominate their
+   decoding. */
+#define RC_GET_BIT_NB(p, mi) { UInt32 ttt = *(p), mask; RC_NORMALIZE; \
+  bound = (Range >> kNumBitModelTotalBits) * ttt; \
+  mask = 0 - (UInt32)(Code >= bound); \
+  Range = bound + ((Range - bound - bound) & mask); Code -= bound & mask; \
+  *(p) = (CProb)(ttt - ((int)(ttt - (~mask & kBitModelNB)) >> kNumMoveBits)); \
+  mi = mi + mi - mask; }
+
 #define RangeDecoderBitTreeDecode(probs, numLevels, res) \
   { int i = numLevels; res = 1; \
   do { CProb *cp = probs + res; RC_GET_BIT(cp, res) } while(--i != 0); \
@@ -132,38 +147,66 @@ int LzmaDecodeProperties(CLzmaProperties *propsRes, const unsigned char *propsDa
 
 #define kLzmaStreamWasFinishedId (-1)
 
-int LzmaDecode(CLzmaDecoderState *vs,
-    const unsigned char *inStream, SizeT inSize, SizeT *inSizeProcessed,
-    unsigned char *outStream, SizeT outSize, SizeT *outSizeProcessed)
+int LzmaDecoderInit(CLzmaDecoderState *vs,
+    const unsigned char *inStream, SizeT inSize)
 {
   CProb *p = vs->Probs;
-  SizeT nowPos = 0;
-  Byte previousByte = 0;
-  UInt32 posStateMask = (1 << (vs->Properties.pb)) - 1;
-  UInt32 literalPosMask = (1 << (vs->Properties.lp)) - 1;
-  int lc = vs->Properties.lc;
-
-
-  int state = 0;
-  UInt32 rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
-  int len = 0;
   const Byte *Buffer;
   const Byte *BufferLim;
   UInt32 Range;
   UInt32 Code;
 
-  *inSizeProcessed = 0;
-  *outSizeProcessed = 0;
-
   {
     UInt32 i;
-    UInt32 numProbs = Literal + ((UInt32)LZMA_LIT_SIZE << (lc + vs->Properties.lp));
+    UInt32 numProbs = LzmaGetNumProbs(&vs->Properties);
     for (i = 0; i < numProbs; i++)
       p[i] = kBitModelTotal >> 1;
   }
-  
+
+  vs->BufferLim = inStream + inSize;
   RC_INIT(inStream, inSize);
 
+  vs->Buffer = Buffer;
+  vs->Range = Range;
+  vs->Code = Code;
+  vs->State = 0;
+  vs->Reps[0] = vs->Reps[1] = vs->Reps[2] = vs->Reps[3] = 1;
+  vs->RemainLen = 0;
+  vs->NowPos = 0;
+  return LZMA_RESULT_OK;
+}
+
+int LzmaDecode(CLzmaDecoderState *vs,
+    unsigned char *outStream, SizeT outSize)
+{
+  CProb *p = vs->Probs;
+  SizeT nowPos = vs->NowPos;
+  Byte previousByte;
+  UInt32 posStateMask = (1 << (vs->Properties.pb)) - 1;
+  UInt32 literalPosMask = (1 << (vs->Properties.lp)) - 1;
+  int lc = vs->Properties.lc;
+
+
+  int state = vs->State;
+  UInt32 rep0 = vs->Reps[0], rep1 = vs->Reps[1], rep2 = vs->Reps[2], rep3 = vs->Reps[3];
+  int len = vs->RemainLen;
+  const Byte *Buffer = vs->Buffer;
+  const Byte *BufferLim = vs->BufferLim;
+  UInt32 Range = vs->Range;
+  UInt32 Code = vs->Code;
+
+  if (len == kLzmaStreamWasFinishedId)
+    return LZMA_RESULT_OK;
+
+  /* finish a match left over from the previous call */
+  while (len != 0 && nowPos < outSize)
+  {
+    outStream[nowPos] = outStream[nowPos - rep0];
+    nowPos++;
+    len--;
+  }
+  previousByte = nowPos ? outStream[nowPos - 1] : 0;
+
 
   while(nowPos < outSize)
   {
@@ -187,23 +230,26 @@ int LzmaDecode(CLzmaDecoderState *vs,
 
       if (state >= kNumLitStates)
       {
-        int matchByte;
-        matchByte = outStream[nowPos - rep0];
+        /* 'offs' is 0x100 while the decoded bits match those of
+           matchByte and zero afterwards */
+        UInt32 matchByte = outStream[nowPos - rep0];
+        UInt32 offs = 0x100;
         do
         {
-          int bit;
+          UInt32 bit;
           CProb *probLit;
           matchByte <<= 1;
-          bit = (matchByte & 0x100);
-          probLit = prob + 0x100 + bit + symbol;
-          RC_GET_BIT2(probLit, symbol, if (bit != 0) break, if (bit == 0) break)
+          bit = (matchByte & offs);
+          probLit = prob + offs + bit + symbol;
+          RC_GET_BIT_NB(probLit, symbol)
+          offs &= ~(bit ^ (0 - (UInt32)(symbol & 1)));
         }
         while (symbol < 0x100);
       }
       while (symbol < 0x100)
       {
         CProb *probLit = prob + symbol;
-        RC_GET_BIT(probLit, symbol)
+        RC_GET_BIT_NB(probLit, symbol)
       }
       previousByte = (Byte)symbol;
 
@@ -380,19 +426,34 @@ int LzmaDecode(CLzmaDecoderState *vs,
         return LZMA_RESULT_DATA_ERROR;
 
 
-      do
       {
-        previousByte = outStream[nowPos - rep0];
-        len--;
-        outStream[nowPos++] = previousByte;
+        /* copy as much of the match as fits in this call */
+        SizeT count = outSize - nowPos;
+        Byte *dest = outStream + nowPos;
+        const Byte *from = dest - rep0;
+        if (count > (SizeT)len)
+          count = len;
+        len -= count;
+        nowPos += count;
+        do
+          *dest++ = *from++;
+        while (--count != 0);
+        previousByte = dest[-1];
       }
-      while(len != 0 && nowPos < outSize);
     }
   }
   RC_NORMALIZE;
 
 
-  *inSizeProcessed = (SizeT)(Buffer - inStream);
-  *outSizeProcessed = nowPos;
+  vs->Buffer = Buffer;
+  vs->Range = Range;
+  vs->Code = Code;
+  vs->State = state;
+  vs->Reps[0] = rep0;
+  vs->Reps[1] = rep1;
+  vs->Reps[2] = rep2;
+  vs->Reps[3] = rep3;
+  vs->RemainLen = len;
+  vs->NowPos = nowPos;
   return LZMA_RESULT_OK;
 }
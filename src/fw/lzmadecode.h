@@ -56,12 +56,25 @@ typedef struct _CLzmaDecoderState
   CLzmaProperties Properties;
   CProb *Probs;
 
-
+  /* Decoder state kept between LzmaDecode() calls */
+  const unsigned char *Buffer;
+  const unsigned char *BufferLim;
+  UInt32 Range;
+  UInt32 Code;
+  int State;
+  UInt32 Reps[4];
+  int RemainLen;
+  SizeT NowPos;
 } CLzmaDecoderState;
 
+/* Start decoding inStream.  Properties and Probs must be set up. */
+int LzmaDecoderInit(CLzmaDecoderState *vs,
+    const unsigned char *inStream, SizeT inSize);
 
+/* Continue decoding until NowPos reaches outSize (or the end of stream
+   marker is found).  outStream must hold all previously decoded data,
+   as it is used as the dictionary. */
 int LzmaDecode(CLzmaDecoderState *vs,
-    const unsigned char *inStream, SizeT inSize, SizeT *inSizeProcessed,
-    unsigned char *outStream, SizeT outSize, SizeT *outSizeProcessed);
+    unsigned char *outStream, SizeT outSize);
 
 #endif
@@ -79,72 +79,6 @@ ndelay_await_not_bsy(u16 iobase1)
     return await_not_bsy(iobase1);
 }
 
-// Reset a drive
-static void
-ata_reset(struct atadrive_s *adrive_gf)
-{
-    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
-    u8 slave = GET_GLOBALFLAT(adrive_gf->slave);
-    u16 iobase1 = GET_GLOBALFLAT(chan_gf->iobase1);
-    u16 iobase2 = GET_GLOBALFLAT(chan_gf->iobase2);
-
-    dprintf(6, "ata_reset drive=%p\n", &adrive_gf->drive);
-    // Pulse SRST
-    outb(ATA_CB_DC_HD15 | ATA_CB_DC_NIEN | ATA_CB_DC_SRST, iobase2+ATA_CB_DC);
-    udelay(5);
-    outb(ATA_CB_DC_HD15 | ATA_CB_DC_NIEN, iobase2+ATA_CB_DC);
-    msleep(2);
-
-    // wait for device to become not busy.
-    int status = await_not_bsy(iobase1);
-    if (status < 0)
-        goto done;
-    if (slave) {
-        // Change device.
-        u32 end = timer_calc(IDE_TIMEOUT);
-        for (;;) {
-            outb(ATA_CB_DH_DEV1, iobase1 + ATA_CB_DH);
-            status = ndelay_await_not_bsy(iobase1);
-            if (status < 0)
-                goto done;
-            if (inb(iobase1 + ATA_CB_DH) == ATA_CB_DH_DEV1)
-                break;
-            // Change drive request failed to take effect - retry.
-            if (timer_check(end)) {
-                warn_timeout();
-                goto done;
-            }
-        }
-    } else {
-        // QEMU doesn't reset dh on reset, so set it explicitly.
-        outb(ATA_CB_DH_DEV0, iobase1 + ATA_CB_DH);
-    }
-
-    // On a user-reset request, wait for RDY if it is an ATA device.
-    u8 type=GET_GLOBALFLAT(adrive_gf->drive.type);
-    if (type == DTYPE_ATA)
-        status = await_rdy(iobase1);
-
-done:
-    // Enable interrupts
-    outb(ATA_CB_DC_HD15, iobase2+ATA_CB_DC);
-
-    dprintf(6, "ata_reset exit status=%x\n", status);
-}
-
-// Check for drive RDY for 16bit interface command.
-static int
-isready(struct atadrive_s *adrive_gf)
-{
-    // Read the status from controller
-    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
-    u16 iobase1 = GET_GLOBALFLAT(chan_gf->iobase1);
-    u8 status = inb(iobase1 + ATA_CB_STAT);
-    if ((status & (ATA_CB_STAT_BSY|ATA_CB_STAT_RDY)) == ATA_CB_STAT_RDY)
-        return DISK_RET_SUCCESS;
-    return DISK_RET_ENOTREADY;
-}
-
 
 /****************************************************************
  * ATA send command
@@ -189,8 +123,9 @@ send_cmd(struct atadrive_s *adrive_gf, struct ata_pio_command *cmd)
             return status;
     }
 
-    // Check for ATA_CMD_(READ|WRITE)_(SECTORS|DMA)_EXT commands.
-    if ((cmd->command & ~0x11) == ATA_CMD_READ_SECTORS_EXT) {
+    // Check for ATA_CMD_(READ|WRITE)_(SECTORS|DMA|MULTIPLE)_EXT commands.
+    if ((cmd->command & ~0x11) == ATA_CMD_READ_SECTORS_EXT
+        || (cmd->command & ~0x10) == ATA_CMD_READ_MULTIPLE_EXT) {
         outb(cmd->feature2, iobase1 + ATA_CB_FR);
         outb(cmd->sector_count2, iobase1 + ATA_CB_SC);
         outb(cmd->lba_low2, iobase1 + ATA_CB_SN);
@@ -266,14 +201,97 @@ fail:
 }
 
 
+/****************************************************************
+ * ATA reset
+ ****************************************************************/
+
+// Reset a drive
+static void
+ata_reset(struct atadrive_s *adrive_gf)
+{
+    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
+    u8 slave = GET_GLOBALFLAT(adrive_gf->slave);
+    u16 iobase1 = GET_GLOBALFLAT(chan_gf->iobase1);
+    u16 iobase2 = GET_GLOBALFLAT(chan_gf->iobase2);
+
+    dprintf(6, "ata_reset drive=%p\n", &adrive_gf->drive);
+    // Pulse SRST
+    outb(ATA_CB_DC_HD15 | ATA_CB_DC_NIEN | ATA_CB_DC_SRST, iobase2+ATA_CB_DC);
+    udelay(5);
+    outb(ATA_CB_DC_HD15 | ATA_CB_DC_NIEN, iobase2+ATA_CB_DC);
+    msleep(2);
+
+    // wait for device to become not busy.
+    int status = await_not_bsy(iobase1);
+    if (status < 0)
+        goto done;
+    if (slave) {
+        // Change device.
+        u32 end = timer_calc(IDE_TIMEOUT);
+        for (;;) {
+            outb(ATA_CB_DH_DEV1, iobase1 + ATA_CB_DH);
+            status = ndelay_await_not_bsy(iobase1);
+            if (status < 0)
+                goto done;
+            if (inb(iobase1 + ATA_CB_DH) == ATA_CB_DH_DEV1)
+                break;
+            // Change drive request failed to take effect - retry.
+            if (timer_check(end)) {
+                warn_timeout();
+                goto done;
+            }
+        }
+    } else {
+        // QEMU doesn't reset dh on reset, so set it explicitly.
+        outb(ATA_CB_DH_DEV0, iobase1 + ATA_CB_DH);
+    }
+
+    // On a user-reset request, wait for RDY if it is an ATA device.
+    u8 type=GET_GLOBALFLAT(adrive_gf->drive.type);
+    if (type == DTYPE_ATA)
+        status = await_rdy(iobase1);
+
+done:
+    // Enable interrupts
+    outb(ATA_CB_DC_HD15, iobase2+ATA_CB_DC);
+
+    // The reset clears the READ/WRITE MULTIPLE setting - restore it.
+    u8 multcount = GET_GLOBALFLAT(adrive_gf->multcount);
+    if (status >= 0 && multcount > 1) {
+        struct ata_pio_command cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.command = ATA_CMD_SET_MULTIPLE_MODE;
+        cmd.sector_count = multcount;
+        status = ata_cmd_nondata(adrive_gf, &cmd);
+    }
+
+    dprintf(6, "ata_reset exit status=%x\n", status);
+}
+
+// Check for drive RDY for 16bit interface command.
+static int
+isready(struct atadrive_s *adrive_gf)
+{
+    // Read the status from controller
+    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
+    u16 iobase1 = GET_GLOBALFLAT(chan_gf->iobase1);
+    u8 status = inb(iobase1 + ATA_CB_STAT);
+    if ((status & (ATA_CB_STAT_BSY|ATA_CB_STAT_RDY)) == ATA_CB_STAT_RDY)
+        return DISK_RET_SUCCESS;
+    return DISK_RET_ENOTREADY;
+}
+
+
 /****************************************************************
  * ATA PIO transfers
  ****************************************************************/
 
 // Transfer 'op->count' blocks (of 'blocksize' bytes) to/from drive
-// 'op->drive_fl'.
+// 'op->drive_fl'.  Up to 'multcount' blocks are transferred for each
+// data request (as used by the READ/WRITE MULTIPLE commands).
 static int
-ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
+ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize
+                 , int multcount)
 {
     dprintf(16, "ata_pio_transfer id=%p write=%d count=%d bs=%d buf=%p\n"
             , op->drive_fl, iswrite, op->count, blocksize, op->buf_fl);
@@ -283,26 +301,29 @@ ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
     struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
     u16 iobase1 = GET_GLOBALFLAT(chan_gf->iobase1);
     u16 iobase2 = GET_GLOBALFLAT(chan_gf->iobase2);
+    int pio32 = CONFIG_ATA_PIO32 && GET_GLOBALFLAT(chan_gf->pio32);
     int count = op->count;
     void *buf_fl = op->buf_fl;
     int status;
     for (;;) {
+        int blocks = count < multcount ? count : multcount;
+        u32 size = blocks * blocksize;
         if (iswrite) {
             // Write data to controller
             dprintf(16, "Write sector id=%p dest=%p\n", op->drive_fl, buf_fl);
-            if (CONFIG_ATA_PIO32)
-                outsl_fl(iobase1, buf_fl, blocksize / 4);
+            if (pio32)
+                outsl_fl(iobase1, buf_fl, size / 4);
             else
-                outsw_fl(iobase1, buf_fl, blocksize / 2);
+                outsw_fl(iobase1, buf_fl, size / 2);
         } else {
             // Read data from controller
             dprintf(16, "Read sector id=%p dest=%p\n", op->drive_fl, buf_fl);
-            if (CONFIG_ATA_PIO32)
-                insl_fl(iobase1, buf_fl, blocksize / 4);
+            if (pio32)
+                insl_fl(iobase1, buf_fl, size / 4);
             else
-                insw_fl(iobase1, buf_fl, blocksize / 2);
+                insw_fl(iobase1, buf_fl, size / 2);
         }
-        buf_fl += blocksize;
+        buf_fl += size;
 
         status = pause_await_not_bsy(iobase1, iobase2);
         if (status < 0) {
@@ -311,7 +332,7 @@ ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
             return status;
         }
 
-        count--;
+        count -= blocks;
         if (!count)
             break;
         status &= (ATA_CB_STAT_BSY | ATA_CB_STAT_DRQ | ATA_CB_STAT_ERR);
@@ -463,7 +484,8 @@ ata_dma_transfer(struct disk_op_s *op)
 
 // Transfer data to harddrive using PIO protocol.
 static int
-ata_pio_cmd_data(struct disk_op_s *op, int iswrite, struct ata_pio_command *cmd)
+ata_pio_cmd_data(struct disk_op_s *op, int iswrite, struct ata_pio_command *cmd
+                 , int multcount)
 {
     struct atadrive_s *adrive_gf = container_of(
         op->drive_fl, struct atadrive_s, drive);
@@ -480,7 +502,7 @@ ata_pio_cmd_data(struct disk_op_s *op, int iswrite, struct ata_pio_command *cmd)
     ret = ata_wait_data(iobase1);
     if (ret)
         goto fail;
-    ret = ata_pio_transfer(op, iswrite, DISK_SECTOR_SIZE);
+    ret = ata_pio_transfer(op, iswrite, DISK_SECTOR_SIZE, multcount);
 
 fail:
     // Enable interrupts
@@ -509,25 +531,38 @@ ata_readwrite(struct disk_op_s *op, int iswrite)
     u64 lba = op->lba;
 
     int usepio = ata_try_dma(op, iswrite, DISK_SECTOR_SIZE);
+    int multcount = 1;
+    if (usepio) {
+        struct atadrive_s *adrive_gf = container_of(
+            op->drive_fl, struct atadrive_s, drive);
+        multcount = GET_GLOBALFLAT(adrive_gf->multcount) ?: 1;
+    }
 
     struct ata_pio_command cmd;
     memset(&cmd, 0, sizeof(cmd));
 
-    if (op->count >= (1<<8) || lba + op->count >= (1<<28)) {
+    int ext = op->count >= (1<<8) || lba + op->count >= (1<<28);
+    if (ext) {
         cmd.sector_count2 = op->count >> 8;
         cmd.lba_low2 = lba >> 24;
         cmd.lba_mid2 = lba >> 32;
         cmd.lba_high2 = lba >> 40;
         lba &= 0xffffff;
 
-        if (usepio)
+        if (multcount > 1)
+            cmd.command = (iswrite ? ATA_CMD_WRITE_MULTIPLE_EXT
+                           : ATA_CMD_READ_MULTIPLE_EXT);
+        else if (usepio)
             cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS_EXT
                            : ATA_CMD_READ_SECTORS_EXT);
         else
             cmd.command = (iswrite ? ATA_CMD_WRITE_DMA_EXT
                            : ATA_CMD_READ_DMA_EXT);
     } else {
-        if (usepio)
+        if (multcount > 1)
+            cmd.command = (iswrite ? ATA_CMD_WRITE_MULTIPLE
+                           : ATA_CMD_READ_MULTIPLE);
+        else if (usepio)
             cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS
                            : ATA_CMD_READ_SECTORS);
         else
@@ -541,11 +576,24 @@ ata_readwrite(struct disk_op_s *op, int iswrite)
     cmd.lba_high = lba >> 16;
     cmd.device = ((lba >> 24) & 0xf) | ATA_CB_DH_LBA;
 
-    int ret;
+    int ret, count = op->count;
     if (usepio)
-        ret = ata_pio_cmd_data(op, iswrite, &cmd);
+        ret = ata_pio_cmd_data(op, iswrite, &cmd, multcount);
     else
         ret = ata_dma_cmd_data(op, &cmd);
+    if (ret && multcount > 1) {
+        // The drive may have lost its multiple mode setting (eg, if a
+        // reset could not restore it) - retry with a regular PIO command.
+        dprintf(6, "ata multiple command failed - retrying\n");
+        op->count = count;
+        if (ext)
+            cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS_EXT
+                           : ATA_CMD_READ_SECTORS_EXT);
+        else
+            cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS
+                           : ATA_CMD_READ_SECTORS);
+        ret = ata_pio_cmd_data(op, iswrite, &cmd, 1);
+    }
     if (ret)
         return DISK_RET_EBADTRACK;
     return DISK_RET_SUCCESS;
@@ -643,7 +691,7 @@ ata_atapi_process_op(struct disk_op_s *op)
             goto fail;
         }
 
-        ret = ata_pio_transfer(op, 0, blocksize);
+        ret = ata_pio_transfer(op, 0, blocksize, 1);
     }
 
 fail:
@@ -676,7 +724,7 @@ send_ata_identity(struct atadrive_s *adrive, u16 *buffer, int command)
     memset(&cmd, 0, sizeof(cmd));
     cmd.command = command;
 
-    return ata_pio_cmd_data(&dop, 0, &cmd);
+    return ata_pio_cmd_data(&dop, 0, &cmd, 1);
 }
 
 // Extract the ATA/ATAPI version info.
@@ -765,6 +813,32 @@ init_drive_atapi(struct atadrive_s *dummy, u16 *buffer)
     return adrive;
 }
 
+// Enable READ/WRITE MULTIPLE mode using the largest number of sectors
+// per data request that the drive supports (IDENTIFY word 47).
+static void
+ata_set_multiple(struct atadrive_s *adrive, u16 *buffer)
+{
+    u8 max = buffer[47] & 0xff;
+    u8 count = 1;
+    while (count * 2 <= max)
+        count *= 2;
+    if (count <= 1)
+        return;
+    struct ata_pio_command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = ATA_CMD_SET_MULTIPLE_MODE;
+    cmd.sector_count = count;
+    int ret = ata_cmd_nondata(adrive, &cmd);
+    if (ret) {
+        dprintf(1, "ata%d-%d: unable to set multiple mode (%d)\n"
+                , adrive->chan_gf->ataid, adrive->slave, ret);
+        return;
+    }
+    dprintf(3, "ata%d-%d: using %d sectors per multiple transfer\n"
+            , adrive->chan_gf->ataid, adrive->slave, count);
+    adrive->multcount = count;
+}
+
 // Detect if the given drive is a regular ata drive - initialize it if so.
 static struct atadrive_s *
 init_drive_ata(struct atadrive_s *dummy, u16 *buffer)
@@ -780,6 +854,7 @@ init_drive_ata(struct atadrive_s *dummy, u16 *buffer)
         return NULL;
     adrive->drive.type = DTYPE_ATA;
     adrive->drive.blksize = DISK_SECTOR_SIZE;
+    ata_set_multiple(adrive, buffer);
 
     adrive->drive.pchs.cylinder = buffer[1];
     adrive->drive.pchs.head = buffer[3];
@@ -942,6 +1017,8 @@ init_controller(struct pci_device *pci, int chanid, int irq
     chan_gf->iobase1 = port1;
     chan_gf->iobase2 = port2;
     chan_gf->iomaster = master;
+    // Legacy ISA controllers may not support 32bit data port accesses
+    chan_gf->pio32 = !!pci;
     dprintf(1, "ATA controller %d at %x/%x/%x (irq %d dev %x)\n"
             , ataid, port1, port2, master, irq, chan_gf->pci_bdf);
     run_thread(ata_detect, chan_gf);
@@ -12,6 +12,7 @@ struct ata_channel_s {
     u8  irq;
     u8  chanid;
     u8  ataid;
+    u8  pio32;
     int pci_bdf;
     struct pci_device *pci_tmp;
 };
@@ -20,6 +21,7 @@ struct atadrive_s {
     struct drive_s drive;
     struct ata_channel_s *chan_gf;
     u8 slave;
+    u8 multcount;       // Sectors per DRQ block in READ/WRITE MULTIPLE mode
 };
 
 // ata.c
@@ -10,6 +10,7 @@
 #include "byteorder.h" // be32_to_cpu
 #include "farptr.h" // GET_FLATPTR
 #include "output.h" // dprintf
+#include "stacks.h" // run_thread
 #include "std/disk.h" // DISK_RET_EPARAM
 #include "string.h" // memset
 #include "util.h" // timer_calc
@@ -128,6 +129,22 @@ scsi_fill_cmd(struct disk_op_s *op, void *cdbcmd, int maxcdb)
     }
 }
 
+// Determine the number of blocks to place in each command when a
+// large read/write request is split into up to 'maxcmds' commands
+// that the controller processes concurrently.
+u16
+scsi_split_count(struct disk_op_s *op, int blocksize, int maxcmds)
+{
+    if ((op->command != CMD_READ && op->command != CMD_WRITE)
+        || !blocksize || maxcmds <= 1)
+        return op->count;
+    u32 count = DIV_ROUND_UP(op->count, maxcmds);
+    u32 mincount = SCSI_SPLIT_MINSIZE / blocksize;
+    if (count < mincount)
+        count = mincount;
+    return count < op->count ? count : op->count;
+}
+
 // Determine if the command is a request to pull data from the device
 int
 scsi_is_read(struct disk_op_s *op)
@@ -136,30 +153,30 @@ scsi_is_read(struct disk_op_s *op)
         !MODESEGMENT && op->command == CMD_SCSI && op->blocksize);
 }
 
-// Check if a SCSI device is ready to receive commands
-int
-scsi_is_ready(struct disk_op_s *op)
+// Check if a SCSI device is ready to receive commands (waiting until
+// @end for it)
+static int
+scsi_is_ready_until(struct disk_op_s *op, u32 end)
 {
     ASSERT32FLAT();
     dprintf(6, "scsi_is_ready (drive=%p)\n", op->drive_fl);
 
-    /* Retry TEST UNIT READY for 5 seconds unless MEDIUM NOT PRESENT is
-     * reported by the device 3 times.  If the device reports "IN PROGRESS",
-     * 30 seconds is added. */
+    /* Retry TEST UNIT READY until @end (5 seconds for scsi_is_ready())
+     * unless MEDIUM NOT PRESENT is reported by the device 3 times.  If the
+     * device reports "IN PROGRESS", 30 seconds is added. */
     int tries = 3;
     int in_progress = 0;
-    u32 end = timer_calc(5000);
     for (;;) {
-        if (timer_check(end)) {
-            dprintf(1, "test unit ready failed\n");
-            return -1;
-        }
-
         int ret = cdb_test_unit_ready(op);
         if (!ret)
             // Success
             break;
 
+        if (timer_check(end)) {
+            dprintf(1, "test unit ready failed\n");
+            return -1;
+        }
+
         struct cdbres_request_sense sense;
         ret = cdb_get_sense(op, &sense);
         if (ret)
@@ -186,6 +203,13 @@ scsi_is_ready(struct disk_op_s *op)
     return 0;
 }
 
+// Check if a SCSI device is ready to receive commands
+int
+scsi_is_ready(struct disk_op_s *op)
+{
+    return scsi_is_ready_until(op, timer_calc(SCSI_READY_TIMEOUT));
+}
+
 #define CDB_CMD_REPORT_LUNS  0xA0
 
 struct cdb_report_luns {
@@ -281,53 +305,64 @@ int scsi_sequential_scan(struct drive_s *tmp_drive, u32 maxluns,
     return ret;
 }
 
-// Validate drive, find block size / sector count, and register drive.
+struct scsi_scan_s {
+    void *data;
+    scsi_scan_target scan_target;
+    int next, max, threads, found;
+    u32 ready_end;
+};
+
+static void
+scsi_scan_thread(void *data)
+{
+    struct scsi_scan_s *ss = data;
+    while (ss->next < ss->max) {
+        int target = ss->next++;
+        ss->found += ss->scan_target(ss->data, target, ss->ready_end);
+    }
+    ss->threads--;
+}
+
+// Call @scan_target for every target id below @maxtarget, running up to
+// SCSI_SCAN_THREADS scans at the same time.  The controller driver must
+// serialize its own command submission.  All devices found by the scan
+// share one readiness window: @scan_target should pass its @ready_end
+// on to scsi_drive_setup_until().  Returns the total of the @scan_target
+// return values.
 int
-scsi_drive_setup(struct drive_s *drive, const char *s, int prio)
+scsi_scan_targets(void *data, int maxtarget, scsi_scan_target scan_target)
 {
     ASSERT32FLAT();
-    struct disk_op_s dop;
-    memset(&dop, 0, sizeof(dop));
-    dop.drive_fl = drive;
-    struct cdbres_inquiry data;
-    int ret = cdb_get_inquiry(&dop, &data);
-    if (ret)
-        return ret;
-    char vendor[sizeof(data.vendor)+1], product[sizeof(data.product)+1];
-    char rev[sizeof(data.rev)+1];
-    strtcpy(vendor, data.vendor, sizeof(vendor));
-    nullTrailingSpace(vendor);
-    strtcpy(product, data.product, sizeof(product));
-    nullTrailingSpace(product);
-    strtcpy(rev, data.rev, sizeof(rev));
-    nullTrailingSpace(rev);
-    int pdt = data.pdt & 0x1f;
-    int removable = !!(data.removable & 0x80);
-    dprintf(1, "%s vendor='%s' product='%s' rev='%s' type=%d removable=%d\n"
-            , s, vendor, product, rev, pdt, removable);
-    drive->removable = removable;
-
-    if (pdt == SCSI_TYPE_CDROM) {
-        drive->blksize = CDROM_SECTOR_SIZE;
-        drive->sectors = (u64)-1;
+    struct scsi_scan_s ss = {
+        .data = data, .scan_target = scan_target, .max = maxtarget,
+        .ready_end = timer_calc(SCSI_READY_TIMEOUT),
+    };
 
-        char *desc = znprintf(MAXDESCSIZE, "DVD/CD [%s Drive %s %s %s]"
-                              , s, vendor, product, rev);
-        boot_add_cd(drive, desc, prio);
-        return 0;
+    int i;
+    for (i = 0; i < SCSI_SCAN_THREADS && i < maxtarget; i++) {
+        ss.threads++;
+        run_thread(scsi_scan_thread, &ss);
     }
+    while (ss.threads)
+        yield();
 
-    if (pdt != SCSI_TYPE_DISK)
-        return -1;
+    return ss.found;
+}
 
-    ret = scsi_is_ready(&dop);
+// Determine the size and geometry of a SCSI disk.
+static int
+scsi_disk_probe(struct disk_op_s *dop, const char *s, int isqemu
+                , u32 ready_end)
+{
+    int ret = scsi_is_ready_until(dop, ready_end);
     if (ret) {
         dprintf(1, "scsi_is_ready returned %d\n", ret);
         return ret;
     }
 
+    struct drive_s *drive = dop->drive_fl;
     struct cdbres_read_capacity capdata;
-    ret = cdb_read_capacity(&dop, &capdata);
+    ret = cdb_read_capacity(dop, &capdata);
     if (ret)
         return ret;
 
@@ -351,9 +386,9 @@ scsi_drive_setup(struct drive_s *drive, const char *s, int prio)
     // but some old USB keys only support a very small subset of SCSI which
     // does not even include the MODE SENSE command!
     //
-    if (CONFIG_QEMU_HARDWARE && memcmp(vendor, "QEMU", 5) == 0) {
+    if (CONFIG_QEMU_HARDWARE && isqemu) {
         struct cdbres_mode_sense_geom geomdata;
-        ret = cdb_mode_sense_geom(&dop, &geomdata);
+        ret = cdb_mode_sense_geom(dop, &geomdata);
         if (ret == 0) {
             u32 cylinders;
             cylinders = geomdata.cyl[0] << 16;
@@ -368,9 +403,96 @@ scsi_drive_setup(struct drive_s *drive, const char *s, int prio)
             }
         }
     }
+    return 0;
+}
+
+// Validate drive, find block size / sector count, and register drive.
+// A disk gets until @ready_end to become ready.
+int
+scsi_drive_setup_until(struct drive_s *drive, const char *s, int prio
+                       , u32 ready_end)
+{
+    ASSERT32FLAT();
+    struct disk_op_s dop;
+    memset(&dop, 0, sizeof(dop));
+    dop.drive_fl = drive;
+    struct cdbres_inquiry data;
+    int ret = cdb_get_inquiry(&dop, &data);
+    if (ret)
+        return ret;
+    char vendor[sizeof(data.vendor)+1], product[sizeof(data.product)+1];
+    char rev[sizeof(data.rev)+1];
+    strtcpy(vendor, data.vendor, sizeof(vendor));
+    nullTrailingSpace(vendor);
+    strtcpy(product, data.product, sizeof(product));
+    nullTrailingSpace(product);
+    strtcpy(rev, data.rev, sizeof(rev));
+    nullTrailingSpace(rev);
+    int pdt = data.pdt & 0x1f;
+    int removable = !!(data.removable & 0x80);
+    dprintf(1, "%s vendor='%s' product='%s' rev='%s' type=%d removable=%d\n"
+            , s, vendor, product, rev, pdt, removable);
+    drive->removable = removable;
+
+    if (pdt == SCSI_TYPE_CDROM) {
+        drive->blksize = CDROM_SECTOR_SIZE;
+        drive->sectors = (u64)-1;
+
+        char *desc = znprintf(MAXDESCSIZE, "DVD/CD [%s Drive %s %s %s]"
+                              , s, vendor, product, rev);
+        boot_add_cd(drive, desc, prio);
+        return 0;
+    }
+
+    if (pdt != SCSI_TYPE_DISK)
+        return -1;
+
+    if (LazyDriveProbe && bootorder_present() && prio != 1
+        && (u32)drive < BUILD_LOWRAM_END) {
+        // Not the first boot order entry - only register the drive now
+        // and let scsi_drive_probe_deferred() complete the setup on
+        // first access.
+        drive->blksize = DISK_SECTOR_SIZE;
+        drive->deferred = 1;
+    } else {
+        ret = scsi_disk_probe(&dop, s, memcmp(vendor, "QEMU", 5) == 0
+                              , ready_end);
+        if (ret)
+            return ret;
+    }
 
     char *desc = znprintf(MAXDESCSIZE, "%s Drive %s %s %s"
                           , s, vendor, product, rev);
     boot_add_hd(drive, desc, prio);
     return 0;
 }
+
+// Validate drive, find block size / sector count, and register drive.
+int
+scsi_drive_setup(struct drive_s *drive, const char *s, int prio)
+{
+    return scsi_drive_setup_until(drive, s, prio
+                                  , timer_calc(SCSI_READY_TIMEOUT));
+}
+
+// Complete the setup of a disk registered by scsi_drive_setup() without
+// a full probe.
+int
+scsi_drive_probe_deferred(struct drive_s *drive)
+{
+    ASSERT32FLAT();
+    struct disk_op_s dop;
+    memset(&dop, 0, sizeof(dop));
+    dop.drive_fl = drive;
+    struct cdbres_inquiry data;
+    int ret = cdb_get_inquiry(&dop, &data);
+    if (!ret)
+        ret = scsi_disk_probe(&dop, "scsi"
+                              , memcmp(data.vendor, "QEMU    ", 8) == 0
+                              , timer_calc(SCSI_READY_TIMEOUT));
+    if (ret) {
+        dprintf(1, "Deferred probe of drive %p failed (%d)\n", drive, ret);
+        drive->sectors = 0;
+    }
+    return ret;
+}
@@ -100,15 +100,28 @@ struct cdbres_mode_sense_geom {
 } PACKED;
 
 // blockcmd.c
+// Don't split read/write requests into commands smaller than this (a
+// 64KiB request, the largest process_op() accepts, can use 4 commands).
+#define SCSI_SPLIT_MINSIZE (16*1024)
+// Maximum number of targets scanned in parallel on one controller.
+#define SCSI_SCAN_THREADS 8
+// Time (in ms) to wait for a device to become ready.
+#define SCSI_READY_TIMEOUT 5000
 struct disk_op_s;
 int scsi_fill_cmd(struct disk_op_s *op, void *cdbcmd, int maxcdb);
+u16 scsi_split_count(struct disk_op_s *op, int blocksize, int maxcmds);
 int scsi_is_read(struct disk_op_s *op);
 int scsi_is_ready(struct disk_op_s *op);
 struct drive_s;
+int scsi_drive_setup_until(struct drive_s *drive, const char *s, int prio
+                           , u32 ready_end);
 int scsi_drive_setup(struct drive_s *drive, const char *s, int prio);
+int scsi_drive_probe_deferred(struct drive_s *drive);
 typedef int (*scsi_add_lun)(u32 lun, struct drive_s *tmpl_drv);
 int scsi_rep_luns_scan(struct drive_s *tmp_drive, scsi_add_lun add_lun);
 int scsi_sequential_scan(struct drive_s *tmp_drive, u32 maxluns,
                          scsi_add_lun add_lun);
+typedef int (*scsi_scan_target)(void *data, int target, u32 ready_end);
+int scsi_scan_targets(void *data, int maxtarget, scsi_scan_target scan_target);
 
 #endif // blockcmd.h
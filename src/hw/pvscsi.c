@@ -123,6 +123,7 @@ struct PVSCSIRingReqDesc {
 } PACKED;
 
 struct pvscsi_ring_dsc_s {
+    struct mutex_s lock;
     struct PVSCSIRingsState *ring_state;
     struct PVSCSIRingReqDesc *ring_reqs;
     struct PVSCSIRingCmpDesc *ring_cmps;
@@ -130,6 +131,7 @@ struct pvscsi_ring_dsc_s {
 
 struct pvscsi_lun_s {
     struct drive_s drive;
+    struct pci_device *pci;
     void *iobase;
     u8 target;
     u8 lun;
@@ -155,9 +157,9 @@ pvscsi_kick_rw_io(void *iobase)
 }
 
 static void
-pvscsi_wait_intr_cmpl(void *iobase)
+pvscsi_wait_cmpl(void *iobase, struct PVSCSIRingsState *s)
 {
-    while (!(readl(iobase + PVSCSI_REG_OFFSET_INTR_STATUS) & PVSCSI_INTR_CMPL_MASK))
+    while (s->cmpProdIdx == s->cmpConsIdx)
         usleep(5);
     writel(iobase + PVSCSI_REG_OFFSET_INTR_STATUS, PVSCSI_INTR_CMPL_MASK);
 }
@@ -172,6 +174,7 @@ pvscsi_init_rings(void *iobase, struct pvscsi_ring_dsc_s **ring_dsc)
         warn_noalloc();
         return;
     }
+    memset(dsc, 0, sizeof(*dsc));
 
     dsc->ring_state =
         (struct PVSCSIRingsState *)memalign_high(PAGE_SIZE, PAGE_SIZE);
@@ -200,13 +203,38 @@ pvscsi_init_rings(void *iobase, struct pvscsi_ring_dsc_s **ring_dsc)
 
 static u32
 pvscsi_get_rsp(struct PVSCSIRingsState *s,
-               struct PVSCSIRingCmpDesc *rsp)
+               struct PVSCSIRingCmpDesc *rsp, u32 *context)
 {
     u32 status = rsp->hostStatus;
+    *context = rsp->context;
     s->cmpConsIdx = s->cmpConsIdx + 1;
     return status;
 }
 
+static void
+pvscsi_fill_req(struct pvscsi_lun_s *plun, struct PVSCSIRingReqDesc *req,
+                struct disk_op_s *op, int blocksize, u32 context)
+{
+    scsi_fill_cmd(op, req->cdb, 16);
+    req->context = context;
+    req->bus = 0;
+    req->target = plun->target;
+    memset(req->lun, 0, sizeof(req->lun));
+    req->lun[1] = plun->lun;
+    req->senseLen = 0;
+    req->senseAddr = 0;
+    req->cdbLen = 16;
+    req->vcpuHint = 0;
+    req->tag = SIMPLE_QUEUE_TAG;
+    req->flags = scsi_is_read(op) ?
+        PVSCSI_FLAG_CMD_DIR_TOHOST : PVSCSI_FLAG_CMD_DIR_TODEVICE;
+    req->dataLen = op->count * blocksize;
+    req->dataAddr = (u32)op->buf_fl;
+}
+
+// Maximum number of requests kept in flight for a single disk op.
+#define PVSCSI_MAX_REQS 4
+
 int
 pvscsi_process_op(struct disk_op_s *op)
 {
@@ -220,47 +248,79 @@ pvscsi_process_op(struct disk_op_s *op)
     u32 cmp_entries = s->cmpNumEntriesLog2;
     struct PVSCSIRingReqDesc *req;
     struct PVSCSIRingCmpDesc *rsp;
-    u32 status;
 
+    mutex_lock(&ring_dsc->lock);
     if (s->reqProdIdx - s->cmpConsIdx >= 1 << req_entries) {
         dprintf(1, "pvscsi: ring full: reqProdIdx=%d cmpConsIdx=%d\n",
                 s->reqProdIdx, s->cmpConsIdx);
+        mutex_unlock(&ring_dsc->lock);
         return DISK_RET_EBADTRACK;
     }
+    u32 avail = (1 << req_entries) - (s->reqProdIdx - s->cmpConsIdx);
 
     req = ring_dsc->ring_reqs + (s->reqProdIdx & MASK(req_entries));
     int blocksize = scsi_fill_cmd(op, req->cdb, 16);
-    if (blocksize < 0)
+    if (blocksize < 0) {
+        mutex_unlock(&ring_dsc->lock);
         return default_process_op(op);
-    req->bus = 0;
-    req->target = plun->target;
-    memset(req->lun, 0, sizeof(req->lun));
-    req->lun[1] = plun->lun;
-    req->senseLen = 0;
-    req->senseAddr = 0;
-    req->cdbLen = 16;
-    req->vcpuHint = 0;
-    req->tag = SIMPLE_QUEUE_TAG;
-    req->flags = scsi_is_read(op) ?
-        PVSCSI_FLAG_CMD_DIR_TOHOST : PVSCSI_FLAG_CMD_DIR_TODEVICE;
-    req->dataLen = op->count * blocksize;
-    req->dataAddr = (u32)op->buf_fl;
-    s->reqProdIdx = s->reqProdIdx + 1;
+    }
 
-    pvscsi_kick_rw_io(plun->iobase);
-    pvscsi_wait_intr_cmpl(plun->iobase);
+    // Split large reads/writes so several requests are in flight
+    int maxreqs = avail < PVSCSI_MAX_REQS ? avail : PVSCSI_MAX_REQS;
+    u16 chunk = scsi_split_count(op, blocksize, maxreqs);
+    u16 counts[PVSCSI_MAX_REQS];
+    struct disk_op_s sub = *op;
+    int num = 0;
+    u32 done = 0;
+    for (;;) {
+        sub.count = op->count - done;
+        if (sub.count > chunk)
+            sub.count = chunk;
+        if (num) {
+            sub.lba = op->lba + done;
+            sub.buf_fl = op->buf_fl + done * blocksize;
+        }
+        req = ring_dsc->ring_reqs + (s->reqProdIdx & MASK(req_entries));
+        pvscsi_fill_req(plun, req, &sub, blocksize, num);
+        s->reqProdIdx = s->reqProdIdx + 1;
+        counts[num++] = sub.count;
+        done += sub.count;
+        if (done >= op->count)
+            break;
+    }
 
-    rsp = ring_dsc->ring_cmps + (s->cmpConsIdx & MASK(cmp_entries));
-    status = pvscsi_get_rsp(s, rsp);
+    pvscsi_kick_rw_io(plun->iobase);
 
-    return status == 0 ? DISK_RET_SUCCESS : DISK_RET_EBADTRACK;
+    // Reap completions (which may arrive in any order)
+    u32 failed = 0;
+    int i;
+    for (i = 0; i < num; i++) {
+        pvscsi_wait_cmpl(plun->iobase, s);
+        rsp = ring_dsc->ring_cmps + (s->cmpConsIdx & MASK(cmp_entries));
+        u32 context;
+        u32 status = pvscsi_get_rsp(s, rsp, &context);
+        if (status)
+            failed |= 1 << (context < num ? context : 0);
+    }
+    mutex_unlock(&ring_dsc->lock);
+    if (!failed)
+        return DISK_RET_SUCCESS;
+
+    // Report the blocks transferred before the first failed request
+    if (num > 1) {
+        for (done = 0, i = 0; !(failed & (1 << i)); i++)
+            done += counts[i];
+        op->count = done;
+    }
+    return DISK_RET_EBADTRACK;
 }
 
 static int
-pvscsi_add_lun(struct pci_device *pci, void *iobase,
-               struct pvscsi_ring_dsc_s *ring_dsc, u8 target, u8 lun)
+pvscsi_add_lun(struct pvscsi_lun_s *tmpl_plun, u8 target, u8 lun
+               , u32 ready_end)
 {
-    struct pvscsi_lun_s *plun = malloc_fseg(sizeof(*plun));
+    struct pci_device *pci = tmpl_plun->pci;
+    struct pvscsi_lun_s *plun = malloc_low(sizeof(*plun));
     if (!plun) {
         warn_noalloc();
         return -1;
@@ -268,15 +328,16 @@ pvscsi_add_lun(struct pci_device *pci, void *iobase,
     memset(plun, 0, sizeof(*plun));
     plun->drive.type = DTYPE_PVSCSI;
     plun->drive.cntl_id = pci->bdf;
+    plun->pci = pci;
     plun->target = target;
     plun->lun = lun;
-    plun->iobase = iobase;
-    plun->ring_dsc = ring_dsc;
+    plun->iobase = tmpl_plun->iobase;
+    plun->ring_dsc = tmpl_plun->ring_dsc;
 
     boot_lchs_find_scsi_device(pci, target, lun, &(plun->drive.lchs));
     char *name = znprintf(MAXDESCSIZE, "pvscsi %pP %d:%d", pci, target, lun);
     int prio = bootprio_find_scsi_device(pci, target, lun);
-    int ret = scsi_drive_setup(&plun->drive, name, prio);
+    int ret = scsi_drive_setup_until(&plun->drive, name, prio, ready_end);
     free(name);
     if (ret)
         goto fail;
@@ -287,12 +348,11 @@ fail:
     return -1;
 }
 
-static void
-pvscsi_scan_target(struct pci_device *pci, void *iobase,
-                   struct pvscsi_ring_dsc_s *ring_dsc, u8 target)
+static int
+pvscsi_scan_target(void *data, int target, u32 ready_end)
 {
     /* pvscsi has no more than a single lun per target */
-    pvscsi_add_lun(pci, iobase, ring_dsc, target, 0);
+    return !pvscsi_add_lun(data, target, 0, ready_end);
 }
 
 static void
@@ -310,9 +370,13 @@ init_pvscsi(void *data)
 
     struct pvscsi_ring_dsc_s *ring_dsc = NULL;
     pvscsi_init_rings(iobase, &ring_dsc);
-    int i;
-    for (i = 0; i < 64; i++)
-        pvscsi_scan_target(pci, iobase, ring_dsc, i);
+
+    struct pvscsi_lun_s tmpl_plun;
+    memset(&tmpl_plun, 0, sizeof(tmpl_plun));
+    tmpl_plun.pci = pci;
+    tmpl_plun.iobase = iobase;
+    tmpl_plun.ring_dsc = ring_dsc;
+    scsi_scan_targets(&tmpl_plun, 64, pvscsi_scan_target);
 }
 
 void
@@ -6,8 +6,10 @@
 
 #include "biosvar.h" // GET_GLOBALFLAT
 #include "block.h" // struct drive_s
+#include "blockcmd.h" // CDB_CMD_TEST_UNIT_READY
 #include "bregs.h" // struct bregs
 #include "e820map.h" // e820_add
+#include "fw/lz4decode.h" // lz4_decompress_block
 #include "malloc.h" // memalign_tmphigh
 #include "memmap.h" // PAGE_SIZE
 #include "output.h" // dprintf
@@ -15,10 +17,26 @@
 #include "stacks.h" // call16_int
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
-#include "util.h" // process_ramdisk_op
+#include "util.h" // process_ramdisk_op, cbfs_romfile_map
 
-void
-ramdisk_setup(void)
+
+/****************************************************************
+ * Floppy images
+ ****************************************************************/
+
+// Ramdisk state (stored in the f-segment so it is readable in 16bit mode)
+struct ramdisk_s {
+    u32 image;          // Location of the image in ram
+    u32 size;
+    void *source;       // Mapped flash image for lazy page-in (or NULL)
+    u8 *present;        // Bitmap of pages already copied from 'source'
+};
+
+// Floppy image that is being paged in lazily (see ramdisk_prepboot())
+static struct ramdisk_s *LazyFloppy;
+
+static void
+ramdisk_floppy_setup(void)
 {
     if (!CONFIG_FLASH_FLOPPY)
         return;
@@ -37,32 +55,104 @@ ramdisk_setup(void)
     }
 
     // Allocate ram for image.
+    struct ramdisk_s *rd = malloc_fseg(sizeof(*rd));
     void *pos = memalign_tmphigh(PAGE_SIZE, size);
-    if (!pos) {
+    if (!rd || !pos) {
         warn_noalloc();
+        free(rd);
+        free(pos);
         return;
     }
-    e820_add((u32)pos, size, E820_RESERVED);
+    memset(rd, 0, sizeof(*rd));
+    rd->image = (u32)pos;
+    rd->size = size;
 
-    // Copy image into ram.
-    int ret = file->copy(file, pos, size);
-    if (ret < 0)
-        return;
+    // If the image is directly mapped in flash, copy pages on first
+    // access instead of copying the whole image now.
+    void *source = cbfs_romfile_map(file);
+    if (source) {
+        u32 bitmapsize = DIV_ROUND_UP(size, PAGE_SIZE * 8);
+        rd->present = malloc_high(bitmapsize);
+        if (rd->present) {
+            memset(rd->present, 0, bitmapsize);
+            rd->source = source;
+            LazyFloppy = rd;
+        }
+    }
+    if (!rd->source) {
+        // Copy image into ram.
+        int ret = file->copy(file, pos, size);
+        if (ret < 0) {
+            free(rd);
+            free(pos);
+            return;
+        }
+    }
+    e820_add((u32)pos, size, E820_RESERVED);
 
     // Setup driver.
-    struct drive_s *drive = init_floppy((u32)pos, ftype);
+    struct drive_s *drive = init_floppy((u32)rd, ftype);
     if (!drive)
         return;
     drive->type = DTYPE_RAMDISK;
-    dprintf(1, "Mapping floppy %s to addr %p\n", filename, pos);
+    dprintf(1, "Mapping floppy %s to addr %p%s\n", filename, pos
+            , rd->source ? " (lazy)" : "");
     char *desc = znprintf(MAXDESCSIZE, "Ramdisk [%s]", &filename[10]);
     boot_add_floppy(drive, desc, bootprio_find_named_rom(filename, 0));
 }
 
+// Copy any not yet loaded pages of the given area from flash.
+static void
+ramdisk_pagein(struct ramdisk_s *rd, u32 offset, u32 len)
+{
+    u32 page = offset / PAGE_SIZE, last = (offset + len - 1) / PAGE_SIZE;
+    for (; page <= last; page++) {
+        u8 bit = 1 << (page % 8);
+        if (rd->present[page / 8] & bit)
+            continue;
+        u32 pos = page * PAGE_SIZE, count = PAGE_SIZE;
+        if (count > rd->size - pos)
+            count = rd->size - pos;
+        memcpy((void*)rd->image + pos, rd->source + pos, count);
+        rd->present[page / 8] |= bit;
+    }
+}
+
+// Copy data using a direct memcpy (32bit mode only).
+static int
+ramdisk_copy_32(struct disk_op_s *op, int iswrite)
+{
+    struct ramdisk_s *rd = (void*)op->drive_fl->cntl_id;
+    u32 offset = (u32)op->lba * DISK_SECTOR_SIZE;
+    u32 len = op->count * DISK_SECTOR_SIZE;
+    if (offset >= rd->size || len > rd->size - offset)
+        return DISK_RET_EBADTRACK;
+    if (!len)
+        return DISK_RET_SUCCESS;
+    if (rd->source)
+        ramdisk_pagein(rd, offset, len);
+
+    void *pos = (void*)rd->image + offset;
+    if (iswrite)
+        memcpy(pos, op->buf_fl, len);
+    else
+        memcpy(op->buf_fl, pos, len);
+    return DISK_RET_SUCCESS;
+}
+
 static int
 ramdisk_copy(struct disk_op_s *op, int iswrite)
 {
-    u32 offset = GET_GLOBALFLAT(op->drive_fl->cntl_id);
+    if (!MODESEGMENT)
+        return ramdisk_copy_32(op, iswrite);
+
+    struct ramdisk_s *rd = (void*)GET_GLOBALFLAT(op->drive_fl->cntl_id);
+    if (GET_GLOBALFLAT(rd->source))
+        // Lazily loaded images (only during POST) are only accessible
+        // from 32bit mode
+        return call32(process_op_32, MAKE_FLATPTR(GET_SEG(SS), op)
+                      , DISK_RET_EPARAM);
+    u32 offset = GET_GLOBALFLAT(rd->image);
     offset += (u32)op->lba * DISK_SECTOR_SIZE;
     u64 opd = GDT_DATA | GDT_LIMIT(0xfffff) | GDT_BASE((u32)op->buf_fl);
     u64 ramd = GDT_DATA | GDT_LIMIT(0xfffff) | GDT_BASE(offset);
@@ -91,9 +181,286 @@ ramdisk_copy(struct disk_op_s *op, int iswrite)
     return DISK_RET_SUCCESS;
 }
 
+
+/****************************************************************
+ * Hard disk and CD-ROM images
+ ****************************************************************/
+
+// Header of a chunk compressed disk image.  It is followed by
+// chunkcount+1 offsets (from the start of the file) of the stored
+// chunks.  A chunk with a stored size of zero is all zeros, a chunk
+// stored at its full size is uncompressed, and any other chunk is a
+// raw lz4 block.  Images without this header are used as is.
+struct diskimg_header_s {
+    u32 magic;
+    u32 chunkshift;
+    u32 chunkcount;
+    u32 reserved;
+    u64 size;
+    u32 index[0];
+} PACKED;
+
+#define DISKIMG_MAGIC 0x49444253 // "SBDI"
+#define DISKIMG_MIN_SHIFT 11
+#define DISKIMG_MAX_SHIFT 20
+#define DISKIMG_RAW_SHIFT 16
+
+// Cache of uncompressed chunks (in high memory, as it is updated at runtime)
+struct diskimg_cache_s {
+    void *buf;
+    u32 tag[CONFIG_DISKIMG_CACHE_CHUNKS]; // chunk number + 1 (0 if unused)
+    u32 lastuse[CONFIG_DISKIMG_CACHE_CHUNKS];
+    u32 usecount;
+};
+
+struct diskimg_s {
+    struct drive_s drive;
+    void *data;         // Image file contents (in flash or ram)
+    u32 *index;         // Chunk index (NULL if the image is not compressed)
+    u32 chunkshift, chunkcount;
+    u64 size;
+    struct diskimg_cache_s *cache;
+};
+
+// Check the header of a chunk compressed image and setup its cache.
+static int
+diskimg_init_chunks(struct diskimg_s *di, u32 filesize)
+{
+    struct diskimg_header_s *hdr = di->data;
+    u32 shift = hdr->chunkshift, count = hdr->chunkcount;
+    if (shift < DISKIMG_MIN_SHIFT || shift > DISKIMG_MAX_SHIFT
+        || count >= filesize / sizeof(hdr->index[0])
+        || sizeof(*hdr) + (count + 1) * sizeof(hdr->index[0]) > filesize
+        || (hdr->size + (1 << shift) - 1) >> shift != count
+        || hdr->index[count] > filesize)
+        return -1;
+    int i;
+    for (i=0; i<count; i++)
+        if (hdr->index[i] > hdr->index[i+1])
+            return -1;
+
+    struct diskimg_cache_s *cache = malloc_high(sizeof(*cache));
+    u32 bufsize = CONFIG_DISKIMG_CACHE_CHUNKS << shift;
+    void *buf = memalign_tmphigh(PAGE_SIZE, bufsize);
+    if (!cache || !buf) {
+        warn_noalloc();
+        free(cache);
+        free(buf);
+        return -1;
+    }
+    e820_add((u32)buf, bufsize, E820_RESERVED);
+    memset(cache, 0, sizeof(*cache));
+    cache->buf = buf;
+    di->cache = cache;
+    di->index = hdr->index;
+    di->chunkshift = shift;
+    di->chunkcount = count;
+    di->size = hdr->size;
+    return 0;
+}
+
+static void
+diskimg_setup(struct romfile_s *file, int iscd, int id)
+{
+    const char *filename = file->name;
+    u32 filesize = file->size;
+    dprintf(3, "Found disk image %s of size %d\n", filename, filesize);
+    struct diskimg_s *di = malloc_fseg(sizeof(*di));
+    if (!di) {
+        warn_noalloc();
+        return;
+    }
+    memset(di, 0, sizeof(*di));
+
+    // Use the image in place if it is mapped in flash - otherwise
+    // keep a (possibly compressed) copy of the file in ram.
+    void *data = cbfs_romfile_map(file);
+    int inram = !data;
+    if (inram) {
+        data = memalign_tmphigh(PAGE_SIZE, filesize);
+        if (!data) {
+            warn_noalloc();
+            goto fail;
+        }
+        int ret = file->copy(file, data, filesize);
+        if (ret < 0)
+            goto fail;
+    }
+    di->data = data;
+
+    struct diskimg_header_s *hdr = data;
+    if (filesize >= sizeof(*hdr) && hdr->magic == DISKIMG_MAGIC) {
+        int ret = diskimg_init_chunks(di, filesize);
+        if (ret) {
+            dprintf(1, "Invalid compressed disk image %s\n", filename);
+            goto fail;
+        }
+    } else {
+        di->size = filesize;
+        di->chunkshift = DISKIMG_RAW_SHIFT;
+    }
+    if (inram)
+        e820_add((u32)data, filesize, E820_RESERVED);
+
+    // Setup driver.
+    di->drive.type = DTYPE_RAMDISK_32;
+    di->drive.cntl_id = id;
+    di->drive.blksize = iscd ? CDROM_SECTOR_SIZE : DISK_SECTOR_SIZE;
+    di->drive.sectors = di->size >> (iscd ? 11 : 9);
+    di->drive.removable = iscd;
+    dprintf(1, "Mapping %s image %s (%u sectors%s)\n", iscd ? "cd" : "disk"
+            , filename, (u32)di->drive.sectors, di->index ? ", compressed" : "");
+    char *desc = znprintf(MAXDESCSIZE, "Ramdisk %s [%s]"
+                          , iscd ? "CD" : "HD", &filename[6]);
+    int prio = bootprio_find_named_rom(filename, 0);
+    if (iscd)
+        boot_add_cd(&di->drive, desc, prio);
+    else
+        boot_add_hd(&di->drive, desc, prio);
+    return;
+fail:
+    if (inram)
+        free(data);
+    free(di);
+}
+
+// Return a pointer to the uncompressed contents of a chunk.
+static void *
+diskimg_getchunk(struct diskimg_s *di, u32 chunk)
+{
+    if (!di->index)
+        return di->data + (chunk << di->chunkshift);
+
+    // Look for the chunk in the cache.
+    struct diskimg_cache_s *cache = di->cache;
+    int i, slot = 0;
+    for (i=0; i<CONFIG_DISKIMG_CACHE_CHUNKS; i++) {
+        if (cache->tag[i] == chunk + 1) {
+            cache->lastuse[i] = ++cache->usecount;
+            return cache->buf + (i << di->chunkshift);
+        }
+        if (cache->lastuse[i] < cache->lastuse[slot])
+            slot = i;
+    }
+
+    // Uncompress it into the least recently used slot.
+    void *dst = cache->buf + (slot << di->chunkshift);
+    u32 start = di->index[chunk], len = di->index[chunk+1] - start;
+    u64 pos = (u64)chunk << di->chunkshift;
+    u32 size = 1 << di->chunkshift;
+    if (size > di->size - pos)
+        size = di->size - pos;
+    cache->tag[slot] = 0;
+    if (!len) {
+        memset(dst, 0, size);
+    } else if (len == size) {
+        memcpy(dst, di->data + start, size);
+    } else {
+        int ret = lz4_decompress_block(dst, size, di->data + start, len);
+        if (ret != size) {
+            dprintf(1, "Unable to uncompress disk image chunk %d\n", chunk);
+            return NULL;
+        }
+    }
+    cache->tag[slot] = chunk + 1;
+    cache->lastuse[slot] = ++cache->usecount;
+    return dst;
+}
+
+static int
+diskimg_read(struct disk_op_s *op)
+{
+    struct diskimg_s *di = container_of(op->drive_fl, struct diskimg_s, drive);
+    if (op->lba >= di->drive.sectors || op->count > di->drive.sectors - op->lba)
+        return DISK_RET_EPARAM;
+    u64 pos = op->lba * di->drive.blksize;
+    u32 len = op->count * di->drive.blksize;
+    u32 mask = (1 << di->chunkshift) - 1;
+    void *buf = op->buf_fl;
+    while (len) {
+        u32 offset = pos & mask, count = mask + 1 - offset;
+        if (count > len)
+            count = len;
+        void *chunk = diskimg_getchunk(di, pos >> di->chunkshift);
+        if (!chunk)
+            return DISK_RET_EBADTRACK;
+        memcpy(buf, chunk + offset, count);
+        buf += count;
+        pos += count;
+        len -= count;
+    }
+    return DISK_RET_SUCCESS;
+}
+
+static int
+diskimg_process_op(struct disk_op_s *op)
+{
+    switch (op->command) {
+    case CMD_READ:
+        return diskimg_read(op);
+    case CMD_WRITE:
+    case CMD_FORMAT:
+        return DISK_RET_EWRITEPROTECT;
+    case CMD_SCSI:
+        // Only "test unit ready" is needed (by the cdrom boot code)
+        if (*(u8*)op->cdbcmd == CDB_CMD_TEST_UNIT_READY)
+            return DISK_RET_SUCCESS;
+        return DISK_RET_EPARAM;
+    default:
+        return default_process_op(op);
+    }
+}
+
+
+/****************************************************************
+ * Setup and dispatch
+ ****************************************************************/
+
+void
+ramdisk_setup(void)
+{
+    ramdisk_floppy_setup();
+
+    if (!CONFIG_FLASH_DISKIMG)
+        return;
+    struct romfile_s *file = NULL;
+    int id = 0;
+    for (;;) {
+        file = romfile_findprefix("hdimg/", file);
+        if (!file)
+            break;
+        diskimg_setup(file, 0, id++);
+    }
+    for (;;) {
+        file = romfile_findprefix("cdimg/", file);
+        if (!file)
+            break;
+        diskimg_setup(file, 1, id++);
+    }
+}
+
+// Copy the rest of a lazily loaded floppy image before boot, so that
+// 16bit callers (which may be running in vm86 mode) can use the int
+// 1587 copy instead of call32().
+void
+ramdisk_prepboot(void)
+{
+    struct ramdisk_s *rd = LazyFloppy;
+    if (!CONFIG_FLASH_FLOPPY || !rd)
+        return;
+    ramdisk_pagein(rd, 0, rd->size);
+    free(rd->present);
+    rd->present = NULL;
+    rd->source = NULL;
+    LazyFloppy = NULL;
+}
+
 int
 ramdisk_process_op(struct disk_op_s *op)
 {
+    if (!MODESEGMENT && CONFIG_FLASH_DISKIMG
+        && op->drive_fl->type == DTYPE_RAMDISK_32)
+        return diskimg_process_op(op);
     if (!CONFIG_FLASH_FLOPPY)
         return 0;
 
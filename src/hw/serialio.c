@@ -127,3 +127,14 @@ qemu_debug_putc(char c)
         // Send character to debug port.
         outb(c, port);
 }
+
+// Write a string of characters to the special debugging port.
+void
+qemu_debug_write(char *s, u32 len)
+{
+    if (!CONFIG_DEBUG_IO || !runningOnQEMU())
+        return;
+    u16 port = GET_GLOBAL(DebugOutputPort);
+    if (port)
+        outsb(port, (u8*)s, len);
+}
@@ -26,5 +26,6 @@ void serial_debug_flush(void);
 extern u16 DebugOutputPort;
 void qemu_debug_preinit(void);
 void qemu_debug_putc(char c);
+void qemu_debug_write(char *s, u32 len);
 
 #endif // serialio.h
@@ -58,6 +58,9 @@ static const u32 tpm_default_durations[3] = {
 static u32 tpm_default_dur[3];
 static u32 tpm_default_to[4];
 
+/* PTP FIFO interface allows 32-bit accesses to the data FIFO */
+static u8 tis_fifo_wide;
+
 static u32 crb_cmd_size;
 static void *crb_cmd;
 static u32 crb_resp_size;
@@ -186,6 +189,8 @@ static u32 tis_init(void)
 
     writeb(TIS_REG(0, TIS_REG_INT_ENABLE), 0);
 
+    tis_fifo_wide = (tis_get_tpm_version() == TPM_VERSION_2);
+
     init_timeout(TIS_DRIVER_IDX);
 
     return 1;
@@ -271,49 +276,49 @@ static u32 tis_ready(void)
     return rc;
 }
 
+/* wait for the TPM to accept more data; return the burst count */
+static u16 tis_wait_burst(u8 locty, u32 end)
+{
+    for (;;) {
+        u16 burst = readl(TIS_REG(locty, TIS_REG_STS)) >> 8;
+        if (burst)
+            return burst;
+        if (timer_check(end)) {
+            warn_timeout();
+            return 0;
+        }
+        yield();
+    }
+}
+
 static u32 tis_senddata(const u8 *const data, u32 len)
 {
     if (!CONFIG_TCGBIOS)
         return 0;
 
-    u32 rc = 0;
     u32 offset = 0;
-    u32 end_loop = 0;
-    u16 burst = 0;
     u8 locty = tis_find_active_locality();
+    void *fifo = TIS_REG(locty, TIS_REG_DATA_FIFO);
     u32 timeout_d = tpm_drivers[TIS_DRIVER_IDX].timeouts[TIS_TIMEOUT_TYPE_D];
     u32 end = timer_calc_usec(timeout_d);
 
-    do {
-        while (burst == 0) {
-               burst = readl(TIS_REG(locty, TIS_REG_STS)) >> 8;
-            if (burst == 0) {
-                if (timer_check(end)) {
-                    warn_timeout();
-                    break;
-                }
-                yield();
-            }
-        }
-
-        if (burst == 0) {
-            rc = TCG_RESPONSE_TIMEOUT;
-            break;
+    while (offset < len) {
+        u16 burst = tis_wait_burst(locty, end);
+        if (burst == 0)
+            return TCG_RESPONSE_TIMEOUT;
+
+        /* write a full burst without polling the status register */
+        if (burst > len - offset)
+            burst = len - offset;
+        if (tis_fifo_wide) {
+            for (; burst >= 4; burst -= 4, offset += 4)
+                writel(fifo, *(u32*)&data[offset]);
         }
+        for (; burst; burst--)
+            writeb(fifo, data[offset++]);
+    }
 
-        while (1) {
-            writeb(TIS_REG(locty, TIS_REG_DATA_FIFO), data[offset++]);
-            burst--;
-
-            if (burst == 0 || offset == len)
-                break;
-        }
-
-        if (offset == len)
-            end_loop = 1;
-    } while (end_loop == 0);
-
-    return rc;
+    return 0;
 }
 
 static u32 tis_readresp(u8 *buffer, u32 *len)
@@ -321,23 +326,33 @@ static u32 tis_readresp(u8 *buffer, u32 *len)
     if (!CONFIG_TCGBIOS)
         return 0;
 
-    u32 rc = 0;
     u32 offset = 0;
-    u32 sts;
     u8 locty = tis_find_active_locality();
+    void *fifo = TIS_REG(locty, TIS_REG_DATA_FIFO);
 
     while (offset < *len) {
-        buffer[offset] = readb(TIS_REG(locty, TIS_REG_DATA_FIFO));
-        offset++;
-        sts = readb(TIS_REG(locty, TIS_REG_STS));
+        u32 sts = readl(TIS_REG(locty, TIS_REG_STS));
         /* data left ? */
         if ((sts & TIS_STS_DATA_AVAILABLE) == 0)
             break;
+
+        /* read all the bytes the TPM has ready in one go */
+        u16 burst = sts >> 8;
+        if (burst == 0)
+            burst = 1;
+        if (burst > *len - offset)
+            burst = *len - offset;
+        if (tis_fifo_wide) {
+            for (; burst >= 4; burst -= 4, offset += 4)
+                *(u32*)&buffer[offset] = readl(fifo);
+        }
+        for (; burst; burst--)
+            buffer[offset++] = readb(fifo);
     }
 
     *len = offset;
 
-    return rc;
+    return 0;
 }
 
 
@@ -455,6 +470,18 @@ static u32 crb_find_active_locality(void)
     return 0;
 }
 
+/* copy to/from the CRB buffers using 32-bit accesses where possible */
+static void crb_copy(void *d, const void *s, u32 len)
+{
+    u32 count = len / 4;
+    asm volatile(
+        "rep movsl (%%esi),%%es:(%%edi)"
+        : "+c"(count), "+S"(s), "+D"(d)
+        : : "cc", "memory");
+    for (len &= 3; len; len--)
+        *(u8*)d++ = *(u8*)s++;
+}
+
 #define CRB_CTRL_REQ_CMD_READY 0b1
 #define CRB_START_INVOKE 0b1
 #define CRB_CTRL_STS_ERROR 0b1
@@ -484,7 +511,7 @@ static u32 crb_senddata(const u8 *const data, u32 len)
         return 1;
 
     u8 locty = crb_find_active_locality();
-    memcpy(crb_cmd, data, len);
+    crb_copy(crb_cmd, data, len);
     writel(CRB_REG(locty, CRB_REG_CTRL_START), CRB_START_INVOKE);
 
     return 0;
@@ -502,14 +529,17 @@ static u32 crb_readresp(u8 *buffer, u32 *len)
     if (*len < 6)
         return 1;
 
-    memcpy(buffer, crb_resp, 6);
+    /* copy the header with aligned accesses; it contains the size */
+    u32 hdrlen = (*len < 8) ? *len : 8;
+    crb_copy(buffer, crb_resp, hdrlen);
     u32 expected = be32_to_cpu(*(u32 *) &buffer[2]);
     if (expected < 6)
         return 1;
 
     *len = (*len < expected) ? *len : expected;
 
-    memcpy(buffer + 6, crb_resp + 6, *len - 6);
+    if (*len > hdrlen)
+        crb_copy(buffer + hdrlen, crb_resp + hdrlen, *len - hdrlen);
 
     return 0;
 }
@@ -570,6 +600,15 @@ struct tpm_driver tpm_drivers[TPM_NUM_DRIVERS] = {
 
 static u8 TPMHW_driver_to_use = TPM_INVALID_DRIVER;
 
+#define TPM_INVALID_LOCALITY 0xff
+
+/* locality kept active between commands (see tpmhw_hold_locality) */
+static u8 TPMHW_hold_locality;
+static u8 TPMHW_held_locality = TPM_INVALID_LOCALITY;
+
+/* serializes commands sent from multiple threads during POST */
+static struct mutex_s TPMHW_lock;
+
 TPMVersion
 tpmhw_probe(void)
 {
@@ -591,42 +630,73 @@ tpmhw_is_present(void)
     return TPMHW_driver_to_use != TPM_INVALID_DRIVER;
 }
 
-int
-tpmhw_transmit(u8 locty, struct tpm_req_header *req,
-               void *respbuffer, u32 *respbufferlen,
-               enum tpmDurationType to_t)
+static int
+__tpmhw_transmit(u8 locty, struct tpm_req_header *req,
+                 void *respbuffer, u32 *respbufferlen,
+                 enum tpmDurationType to_t)
 {
-    if (TPMHW_driver_to_use == TPM_INVALID_DRIVER)
-        return -1;
-
     struct tpm_driver *td = &tpm_drivers[TPMHW_driver_to_use];
 
-    u32 irc = td->activate(locty);
-    if (irc != 0) {
-        /* tpm could not be activated */
-        return -1;
+    u32 irc;
+    if (locty != TPMHW_held_locality) {
+        irc = td->activate(locty);
+        if (irc != 0) {
+            /* tpm could not be activated */
+            goto fail;
+        }
     }
+    TPMHW_held_locality = TPM_INVALID_LOCALITY;
 
     irc = td->senddata((void*)req, be32_to_cpu(req->totlen));
     if (irc != 0)
-        return -1;
+        goto fail;
 
     irc = td->waitdatavalid();
     if (irc != 0)
-        return -1;
+        goto fail;
 
     irc = td->waitrespready(to_t);
     if (irc != 0)
-        return -1;
+        goto fail;
 
     irc = td->readresp(respbuffer, respbufferlen);
     if (irc != 0 ||
         *respbufferlen < sizeof(struct tpm_rsp_header))
-        return -1;
+        goto fail;
 
-    td->ready();
+    /* The locality stays active and the tpm is ready for the next
+     * command, so activation can be skipped while holding the locality. */
+    irc = td->ready();
+    if (irc == 0 && TPMHW_hold_locality)
+        TPMHW_held_locality = locty;
 
     return 0;
+
+fail:
+    TPMHW_held_locality = TPM_INVALID_LOCALITY;
+    return -1;
+}
+
+int
+tpmhw_transmit(u8 locty, struct tpm_req_header *req,
+               void *respbuffer, u32 *respbufferlen,
+               enum tpmDurationType to_t)
+{
+    if (TPMHW_driver_to_use == TPM_INVALID_DRIVER)
+        return -1;
+
+    mutex_lock(&TPMHW_lock);
+    int ret = __tpmhw_transmit(locty, req, respbuffer, respbufferlen, to_t);
+    mutex_unlock(&TPMHW_lock);
+    return ret;
+}
+
+/* Keep the locality active across a sequence of commands */
+void
+tpmhw_hold_locality(int hold)
+{
+    TPMHW_hold_locality = hold;
+    TPMHW_held_locality = TPM_INVALID_LOCALITY;
 }
 
 void
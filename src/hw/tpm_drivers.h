@@ -23,6 +23,7 @@ int tpmhw_transmit(u8 locty, struct tpm_req_header *req,
                    void *respbuffer, u32 *respbufferlen,
                    enum tpmDurationType to_t);
 void tpmhw_set_timeouts(u32 timeouts[4], u32 durations[3]);
+void tpmhw_hold_locality(int hold);
 
 /* CRB driver */
 /* address of locality 0 (CRB) */
@@ -552,65 +552,74 @@ ehci_send_pipe(struct usb_pipe *p, int dir, const void *cmd
     struct ehci_pipe *pipe = container_of(p, struct ehci_pipe, pipe);
     dprintf(7, "ehci_send_pipe qh=%p dir=%d data=%p size=%d\n"
             , &pipe->qh, dir, data, datasize);
+    if (!cmd && !datasize)
+        return 0;
 
-    // Allocate tds on stack (with required alignment)
+    // Allocate a ring of tds on stack (with required alignment)
     u8 tdsbuf[sizeof(struct ehci_qtd) * STACKQTDS + EHCI_QTD_ALIGN - 1];
-    struct ehci_qtd *tds = (void*)ALIGN((u32)tdsbuf, EHCI_QTD_ALIGN), *td = tds;
+    struct ehci_qtd *tds = (void*)ALIGN((u32)tdsbuf, EHCI_QTD_ALIGN);
     memset(tds, 0, sizeof(*tds) * STACKQTDS);
+    int tdpos = 0;
+
+    // Enable tds - the controller waits on the first td until it is active
+    u32 end = timer_calc(usb_xfer_time(p, datasize));
+    barrier();
+    SET_LOWFLAT(pipe->qh.qtd_next, (u32)MAKE_FLATPTR(GET_SEG(SS), tds));
 
     // Setup transfer descriptors
     u16 maxpacket = GET_LOWFLAT(pipe->pipe.maxpacket);
     u32 toggle = 0;
     if (cmd) {
         // Send setup pid on control transfers
-        td->qtd_next = (u32)MAKE_FLATPTR(GET_SEG(SS), td+1);
+        struct ehci_qtd *td = &tds[tdpos++ % STACKQTDS];
+        td->qtd_next = (u32)MAKE_FLATPTR(GET_SEG(SS), &tds[tdpos % STACKQTDS]);
         td->alt_next = EHCI_PTR_TERM;
+        ehci_fill_tdbuf(td, (u32)cmd, USB_CONTROL_SETUP_SIZE);
+        barrier();
         td->token = (ehci_explen(USB_CONTROL_SETUP_SIZE) | QTD_STS_ACTIVE
                      | QTD_PID_SETUP | ehci_maxerr(3));
-        ehci_fill_tdbuf(td, (u32)cmd, USB_CONTROL_SETUP_SIZE);
-        td++;
         toggle = QTD_TOGGLE;
     }
     u32 dest = (u32)data, dataend = dest + datasize;
     while (dest < dataend) {
-        // Send data pids
-        if (td >= &tds[STACKQTDS]) {
-            warn_noalloc();
+        // Send data pids - reuse tds in the ring as the controller
+        // completes them so large transfers stay queued in hardware.
+        struct ehci_qtd *td = &tds[tdpos++ % STACKQTDS];
+        int ret = ehci_wait_td(pipe, td, end);
+        if (ret)
             return -1;
-        }
+
         int maxtransfer = 5*PAGE_SIZE - (dest & (PAGE_SIZE-1));
         int transfer = dataend - dest;
         if (transfer > maxtransfer)
             transfer = ALIGN_DOWN(maxtransfer, maxpacket);
-        td->qtd_next = (u32)MAKE_FLATPTR(GET_SEG(SS), td+1);
+        u32 nexttd = (u32)MAKE_FLATPTR(GET_SEG(SS), &tds[tdpos % STACKQTDS]);
+        td->qtd_next = ((dest + transfer >= dataend && !cmd)
+                        ? EHCI_PTR_TERM : nexttd);
         td->alt_next = EHCI_PTR_TERM;
+        ehci_fill_tdbuf(td, dest, transfer);
+        barrier();
         td->token = (ehci_explen(transfer) | toggle | QTD_STS_ACTIVE
                      | (dir ? QTD_PID_IN : QTD_PID_OUT) | ehci_maxerr(3));
-        ehci_fill_tdbuf(td, dest, transfer);
-        td++;
         dest += transfer;
     }
     if (cmd) {
         // Send status pid on control transfers
-        if (td >= &tds[STACKQTDS]) {
-            warn_noalloc();
+        struct ehci_qtd *td = &tds[tdpos++ % STACKQTDS];
+        int ret = ehci_wait_td(pipe, td, end);
+        if (ret)
             return -1;
-        }
         td->qtd_next = EHCI_PTR_TERM;
         td->alt_next = EHCI_PTR_TERM;
+        barrier();
         td->token = (QTD_TOGGLE | QTD_STS_ACTIVE
                      | (dir ? QTD_PID_OUT : QTD_PID_IN) | ehci_maxerr(3));
-        td++;
     }
 
-    // Transfer data
-    (td-1)->qtd_next = EHCI_PTR_TERM;
-    barrier();
-    SET_LOWFLAT(pipe->qh.qtd_next, (u32)MAKE_FLATPTR(GET_SEG(SS), tds));
-    u32 end = timer_calc(usb_xfer_time(p, datasize));
+    // Wait for the remaining queued tds to complete
     int i;
-    for (i=0, td=tds; i<STACKQTDS; i++, td++) {
-        int ret = ehci_wait_td(pipe, td, end);
+    for (i=0; i<STACKQTDS; i++) {
+        int ret = ehci_wait_td(pipe, &tds[tdpos++ % STACKQTDS], end);
         if (ret)
             return -1;
     }
@@ -6,6 +6,7 @@
 
 #include "biosvar.h" // GET_GLOBAL
 #include "config.h" // CONFIG_*
+#include "fw/paravirt.h" // qemu_cfg_write_file
 #include "malloc.h" // free
 #include "output.h" // dprintf
 #include "romfile.h" // romfile_loadint
@@ -233,6 +234,33 @@ get_device_info8(struct usb_pipe *pipe, struct usb_device_descriptor *dinfo)
     return usb_send_default_control(pipe, &req, dinfo);
 }
 
+// Get the full device descriptor.
+static int
+get_device_info(struct usb_pipe *pipe, struct usb_device_descriptor *dinfo)
+{
+    struct usb_ctrlrequest req;
+    req.bRequestType = USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+    req.bRequest = USB_REQ_GET_DESCRIPTOR;
+    req.wValue = USB_DT_DEVICE<<8;
+    req.wIndex = 0;
+    req.wLength = sizeof(*dinfo);
+    return usb_send_default_control(pipe, &req, dinfo);
+}
+
+// Get the first 'size' bytes of string descriptor 'index'.
+static int
+get_device_string(struct usb_pipe *pipe, u8 index, u16 langid
+                  , void *buf, u8 size)
+{
+    struct usb_ctrlrequest req;
+    req.bRequestType = USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+    req.bRequest = USB_REQ_GET_DESCRIPTOR;
+    req.wValue = (USB_DT_STRING<<8) | index;
+    req.wIndex = langid;
+    req.wLength = size;
+    return usb_send_default_control(pipe, &req, buf);
+}
+
 static struct usb_config_descriptor *
 get_device_config(struct usb_pipe *pipe)
 {
@@ -276,6 +304,242 @@ set_configuration(struct usb_pipe *pipe, u16 val)
 }
 
 
+/****************************************************************
+ * Descriptor cache
+ ****************************************************************/
+
+// The descriptor cache is stored in the "etc/usb-desc-cache" fw_cfg
+// file.  It holds the device, serial number and configuration
+// descriptors of the devices found on the previous boot, keyed by the
+// topology path of each device.
+#define USB_DESC_CACHE_SIGNATURE 0x32435355 // USC2
+
+struct usb_desc_cache_header {
+    u32 signature;
+    u32 used;
+} PACKED;
+
+struct usb_desc_cache_entry {
+    u16 size;
+    u8 pathlen;
+    u8 seriallen;
+    u16 langid;
+    u16 reserved;
+    struct usb_device_descriptor dinfo;
+    // Followed by path, serial number string descriptor and then the
+    // full configuration descriptor
+} PACKED;
+
+// The cache read from the host (only used for lookups) and the cache
+// built during this boot (written back to the host by usb_prepboot()).
+static struct romfile_s *UsbDescCacheFile;
+static struct usb_desc_cache_header *UsbDescCache, *UsbDescCacheNew;
+
+static void
+usb_desc_cache_setup(void)
+{
+    if (!CONFIG_USB_DESC_CACHE || !qemu_cfg_dma_enabled())
+        return;
+    struct romfile_s *file = romfile_find("etc/usb-desc-cache");
+    if (!file || file->size < sizeof(*UsbDescCache))
+        return;
+    struct usb_desc_cache_header *cache = malloc_tmphigh(file->size);
+    struct usb_desc_cache_header *newcache = malloc_tmphigh(file->size);
+    if (!cache || !newcache) {
+        warn_noalloc();
+        free(cache);
+        free(newcache);
+        return;
+    }
+    int ret = file->copy(file, cache, file->size);
+    if (ret < 0 || cache->signature != USB_DESC_CACHE_SIGNATURE
+        || cache->used > file->size - sizeof(*cache)) {
+        // Invalid (or never written) cache - start a new one.
+        cache->signature = USB_DESC_CACHE_SIGNATURE;
+        cache->used = 0;
+    }
+    dprintf(3, "Found usb descriptor cache (%d of %d bytes used)\n"
+            , cache->used, file->size);
+    newcache->signature = USB_DESC_CACHE_SIGNATURE;
+    newcache->used = 0;
+    UsbDescCacheFile = file;
+    UsbDescCache = cache;
+    UsbDescCacheNew = newcache;
+}
+
+static struct usb_desc_cache_entry *
+usb_desc_cache_find(struct usb_desc_cache_header *cache, const char *path)
+{
+    if (!CONFIG_USB_DESC_CACHE || !cache)
+        return NULL;
+    int pathlen = strlen(path);
+    void *pos = &cache[1], *end = pos + cache->used;
+    while (pos + sizeof(struct usb_desc_cache_entry) <= end) {
+        struct usb_desc_cache_entry *ce = pos;
+        int minsize = (sizeof(*ce) + ce->pathlen + ce->seriallen
+                       + sizeof(struct usb_config_descriptor));
+        if (ce->size < minsize || pos + ce->size > end)
+            break;
+        if (ce->pathlen == pathlen && !memcmp(&ce[1], path, pathlen))
+            return ce;
+        pos += ce->size;
+    }
+    return NULL;
+}
+
+// Return a copy of the configuration descriptor in a cache entry.
+static struct usb_config_descriptor *
+usb_desc_cache_config(struct usb_desc_cache_entry *ce)
+{
+    struct usb_config_descriptor *cached = ((void*)&ce[1] + ce->pathlen
+                                            + ce->seriallen);
+    int size = ce->size - sizeof(*ce) - ce->pathlen - ce->seriallen;
+    if (cached->wTotalLength != size)
+        return NULL;
+    struct usb_config_descriptor *config = malloc_tmphigh(size);
+    if (!config) {
+        warn_noalloc();
+        return NULL;
+    }
+    memcpy(config, cached, size);
+    return config;
+}
+
+// Add the descriptors of the device at 'path' to the cache that is
+// written back to the host at the end of POST.
+static void
+usb_desc_cache_add(const char *path, struct usb_device_descriptor *dinfo
+                   , u16 langid, u8 *serial, int seriallen
+                   , struct usb_config_descriptor *config)
+{
+    if (!CONFIG_USB_DESC_CACHE || !UsbDescCacheNew)
+        return;
+    void *start = &UsbDescCacheNew[1];
+    struct usb_desc_cache_entry *ce = usb_desc_cache_find(UsbDescCacheNew
+                                                          , path);
+    if (ce) {
+        void *next = (void*)ce + ce->size;
+        memmove(ce, next, start + UsbDescCacheNew->used - next);
+        UsbDescCacheNew->used -= next - (void*)ce;
+    }
+    int pathlen = strlen(path);
+    int size = sizeof(*ce) + pathlen + seriallen + config->wTotalLength;
+    u32 avail = UsbDescCacheFile->size - sizeof(*UsbDescCacheNew);
+    if (pathlen > 255 || size > 0xffff
+        || UsbDescCacheNew->used + size > avail) {
+        dprintf(1, "No room in usb descriptor cache for %s\n", path);
+        return;
+    }
+    ce = start + UsbDescCacheNew->used;
+    ce->size = size;
+    ce->pathlen = pathlen;
+    ce->seriallen = seriallen;
+    ce->langid = langid;
+    ce->reserved = 0;
+    ce->dinfo = *dinfo;
+    void *pos = &ce[1];
+    memcpy(pos, path, pathlen);
+    memcpy(pos + pathlen, serial, seriallen);
+    memcpy(pos + pathlen + seriallen, config, config->wTotalLength);
+    UsbDescCacheNew->used += size;
+}
+
+// Read the serial number string descriptor of a device and add the
+// device to the descriptor cache.  (Not inlined to keep the serial
+// buffer off the stack during driver setup.)
+static void noinline
+usb_desc_cache_store(struct usbdevice_s *usbdev, const char *path
+                     , struct usb_device_descriptor *dinfo
+                     , struct usb_config_descriptor *config)
+{
+    u8 serial[255];
+    u16 langid = 0;
+    int seriallen = 0;
+    if (dinfo->iSerialNumber) {
+        // Use the first language the device supports.
+        u8 langs[4];
+        int ret = get_device_string(usbdev->defpipe, 0, 0
+                                    , langs, sizeof(langs));
+        if (ret || langs[0] < sizeof(langs))
+            return;
+        langid = langs[2] | (langs[3] << 8);
+        ret = get_device_string(usbdev->defpipe, dinfo->iSerialNumber
+                                , langid, serial, 2);
+        if (ret || serial[0] < 2)
+            return;
+        seriallen = serial[0];
+        ret = get_device_string(usbdev->defpipe, dinfo->iSerialNumber
+                                , langid, serial, seriallen);
+        if (ret)
+            return;
+    }
+    usb_desc_cache_add(path, dinfo, langid, serial, seriallen, config);
+}
+
+// Try to configure the default pipe and fetch the configuration
+// descriptor from a previously cached copy.  The device descriptor
+// and serial number are re-read and compared to validate the cached
+// entry.
+static struct usb_config_descriptor * noinline
+usb_desc_cache_lookup(struct usbdevice_s *usbdev, const char *path)
+{
+    struct usb_desc_cache_entry *ce = usb_desc_cache_find(UsbDescCache, path);
+    if (!ce)
+        return NULL;
+    struct usb_device_descriptor *cached = &ce->dinfo;
+    u16 maxpacket = cached->bMaxPacketSize0;
+    if (cached->bcdUSB >= 0x0300)
+        maxpacket = 1 << cached->bMaxPacketSize0;
+    if (maxpacket < 8)
+        return NULL;
+    struct usb_endpoint_descriptor epdesc = {
+        .wMaxPacketSize = maxpacket,
+        .bmAttributes = USB_ENDPOINT_XFER_CONTROL,
+    };
+    usbdev->defpipe = usb_realloc_pipe(usbdev, usbdev->defpipe, &epdesc);
+    if (!usbdev->defpipe)
+        return NULL;
+    struct usb_device_descriptor dinfo;
+    int ret = get_device_info(usbdev->defpipe, &dinfo);
+    if (ret || memcmp(&dinfo, cached, sizeof(dinfo)))
+        goto mismatch;
+    u8 *cachedserial = (void*)&ce[1] + ce->pathlen;
+    if (ce->seriallen) {
+        u8 serial[255];
+        memset(serial, 0, ce->seriallen);
+        ret = get_device_string(usbdev->defpipe, dinfo.iSerialNumber
+                                , ce->langid, serial, ce->seriallen);
+        if (ret || memcmp(serial, cachedserial, ce->seriallen))
+            goto mismatch;
+    }
+    struct usb_config_descriptor *config = usb_desc_cache_config(ce);
+    if (!config)
+        return NULL;
+    dprintf(3, "usb descriptor cache hit for %s\n", path);
+    usb_desc_cache_add(path, &dinfo, ce->langid, cachedserial, ce->seriallen
+                       , config);
+    return config;
+mismatch:
+    dprintf(3, "usb descriptor cache mismatch for %s\n", path);
+    return NULL;
+}
+
+// Write the descriptor cache built during this boot back to the host.
+void
+usb_prepboot(void)
+{
+    if (!CONFIG_USB_DESC_CACHE || !UsbDescCacheNew)
+        return;
+    u32 size = sizeof(*UsbDescCacheNew) + UsbDescCacheNew->used;
+    if (UsbDescCache->used != UsbDescCacheNew->used
+        || memcmp(UsbDescCache, UsbDescCacheNew, size))
+        qemu_cfg_write_file(UsbDescCacheNew, UsbDescCacheFile, 0, size);
+    free(UsbDescCache);
+    free(UsbDescCacheNew);
+    UsbDescCache = UsbDescCacheNew = NULL;
+}
+
+
 /****************************************************************
  * Initialization and enumeration
  ****************************************************************/
@@ -332,19 +596,21 @@ usb_set_address(struct usbdevice_s *usbdev)
     return 0;
 }
 
-// Called for every found device - see if a driver is available for
-// this device and do setup if so.
-static int
-configure_usb_device(struct usbdevice_s *usbdev)
+// Set the max packet size for endpoint 0 of a device and read its
+// configuration descriptor.
+static struct usb_config_descriptor *
+usb_read_config(struct usbdevice_s *usbdev, const char *path)
 {
-    ASSERT32FLAT();
-    dprintf(3, "config_usb: %p\n", usbdev->defpipe);
-
-    // Set the max packet size for endpoint 0 of this device.
+    // Set the max packet size for endpoint 0 of this device.  High and
+    // super speed devices have a fixed max packet size, so when caching
+    // read the full device descriptor right away.
+    int caching = CONFIG_USB_DESC_CACHE && path[0] && UsbDescCacheNew;
+    int fullinfo = caching && usbdev->speed >= USB_HIGHSPEED;
     struct usb_device_descriptor dinfo;
-    int ret = get_device_info8(usbdev->defpipe, &dinfo);
+    int ret = (fullinfo ? get_device_info(usbdev->defpipe, &dinfo)
+               : get_device_info8(usbdev->defpipe, &dinfo));
     if (ret)
-        return 0;
+        return NULL;
     u16 maxpacket = dinfo.bMaxPacketSize0;
     if (dinfo.bcdUSB >= 0x0300)
         maxpacket = 1 << dinfo.bMaxPacketSize0;
@@ -352,19 +618,49 @@ configure_usb_device(struct usbdevice_s *usbdev)
             , dinfo.bcdUSB, dinfo.bDeviceClass, dinfo.bDeviceSubClass
             , dinfo.bDeviceProtocol, maxpacket);
     if (maxpacket < 8)
-        return 0;
+        return NULL;
     struct usb_endpoint_descriptor epdesc = {
         .wMaxPacketSize = maxpacket,
         .bmAttributes = USB_ENDPOINT_XFER_CONTROL,
     };
     usbdev->defpipe = usb_realloc_pipe(usbdev, usbdev->defpipe, &epdesc);
     if (!usbdev->defpipe)
-        return -1;
+        return NULL;
 
     // Get configuration
     struct usb_config_descriptor *config = get_device_config(usbdev->defpipe);
     if (!config)
-        return 0;
+        return NULL;
+
+    // Save descriptors for use on the next boot.
+    if (caching && (fullinfo || !get_device_info(usbdev->defpipe, &dinfo)))
+        usb_desc_cache_store(usbdev, path, &dinfo, config);
+
+    return config;
+}
+
+// Called for every found device - see if a driver is available for
+// this device and do setup if so.
+static int
+configure_usb_device(struct usbdevice_s *usbdev)
+{
+    ASSERT32FLAT();
+    dprintf(3, "config_usb: %p\n", usbdev->defpipe);
+
+    char path[128];
+    if (!CONFIG_USB_DESC_CACHE
+        || !build_usbdev_path(path, sizeof(path), usbdev))
+        path[0] = '\0';
+    struct usb_config_descriptor *config = NULL;
+    if (path[0])
+        config = usb_desc_cache_lookup(usbdev, path);
+    if (!usbdev->defpipe)
+        return -1;
+    if (!config) {
+        config = usb_read_config(usbdev, path);
+        if (!config)
+            return usbdev->defpipe ? 0 : -1;
+    }
 
     // Determine if a driver exists for this device - only look at the
     // interfaces of the first configuration.
@@ -389,7 +685,7 @@ configure_usb_device(struct usbdevice_s *usbdev)
     }
 
     // Set the configuration.
-    ret = set_configuration(usbdev->defpipe, config->bConfigurationValue);
+    int ret = set_configuration(usbdev->defpipe, config->bConfigurationValue);
     if (ret)
         goto fail;
 
@@ -504,6 +800,7 @@ usb_setup(void)
     if (! CONFIG_USB)
         return;
     dprintf(3, "init usb\n");
+    usb_desc_cache_setup();
     usb_time_sigatt = romfile_loadint("etc/usb-time-sigatt", USB_TIME_SIGATT);
     xhci_setup();
     ehci_setup();
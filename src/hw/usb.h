@@ -251,5 +251,6 @@ struct usb_endpoint_descriptor *usb_find_desc(struct usbdevice_s *usbdev
                                               , int type, int dir);
 void usb_enumerate(struct usbhub_s *hub);
 void usb_setup(void);
+void usb_prepboot(void);
 
 #endif // usb.h
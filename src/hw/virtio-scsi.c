@@ -24,6 +24,21 @@
 #include "virtio-scsi.h"
 #include "virtio-mmio.h"
 
+// Maximum number of requests kept in flight for a single disk op.
+#define VIRTIO_SCSI_MAX_REQS 4
+
+struct virtio_scsi_cmd_s {
+    struct virtio_scsi_req_cmd req;
+    struct virtio_scsi_resp_cmd resp;
+};
+
+// Per controller request state - the lock serializes disk ops from
+// parallel target scans.
+struct virtio_scsi_reqs_s {
+    struct mutex_s lock;
+    struct virtio_scsi_cmd_s cmds[VIRTIO_SCSI_MAX_REQS];
+};
+
 struct virtio_lun_s {
     struct drive_s drive;
     struct pci_device *pci;
@@ -31,42 +46,40 @@ struct virtio_lun_s {
     char name[16];
     struct vring_virtqueue *vq;
     struct vp_device *vp;
+    struct virtio_scsi_reqs_s *reqs;
     u16 target;
     u16 lun;
+    u32 ready_end; // readiness deadline of a target scan (template only)
 };
 
-int
-virtio_scsi_process_op(struct disk_op_s *op)
+// Add a request for 'op' to the virtqueue (without kicking the host)
+static void
+virtio_scsi_add_req(struct virtio_lun_s *vlun, struct virtio_scsi_cmd_s *cmd
+                    , struct disk_op_s *op, int blocksize
+                    , int index, int num_added)
 {
-    if (! CONFIG_VIRTIO_SCSI)
-        return 0;
-    struct virtio_lun_s *vlun =
-        container_of(op->drive_fl, struct virtio_lun_s, drive);
-    struct vp_device *vp = vlun->vp;
-    struct vring_virtqueue *vq = vlun->vq;
-    struct virtio_scsi_req_cmd req;
-    struct virtio_scsi_resp_cmd resp;
+    struct virtio_scsi_req_cmd *req = &cmd->req;
+    struct virtio_scsi_resp_cmd *resp = &cmd->resp;
     struct vring_list sg[3];
 
-    memset(&req, 0, sizeof(req));
-    int blocksize = scsi_fill_cmd(op, req.cdb, 16);
-    if (blocksize < 0)
-        return default_process_op(op);
-    req.lun[0] = 1;
-    req.lun[1] = vlun->target;
-    req.lun[2] = (vlun->lun >> 8) | 0x40;
-    req.lun[3] = (vlun->lun & 0xff);
+    memset(req, 0, sizeof(*req));
+    memset(resp, 0, sizeof(*resp));
+    scsi_fill_cmd(op, req->cdb, 16);
+    req->lun[0] = 1;
+    req->lun[1] = vlun->target;
+    req->lun[2] = (vlun->lun >> 8) | 0x40;
+    req->lun[3] = (vlun->lun & 0xff);
 
     u32 len = op->count * blocksize;
     int datain = scsi_is_read(op);
     int in_num = (datain ? 2 : 1);
     int out_num = (len ? 3 : 2) - in_num;
 
-    sg[0].addr   = (void*)(&req);
-    sg[0].length = sizeof(req);
+    sg[0].addr   = (void*)req;
+    sg[0].length = sizeof(*req);
 
-    sg[out_num].addr   = (void*)(&resp);
-    sg[out_num].length = sizeof(resp);
+    sg[out_num].addr   = (void*)resp;
+    sg[out_num].length = sizeof(*resp);
 
     if (len) {
         int data_idx = (datain ? 2 : 1);
@@ -74,25 +87,81 @@ virtio_scsi_process_op(struct disk_op_s *op)
         sg[data_idx].length = len;
     }
 
-    /* Add to virtqueue and kick host */
-    vring_add_buf(vq, sg, out_num, in_num, 0, 0);
-    vring_kick(vp, vq, 1);
+    vring_add_buf(vlun->vq, sg, out_num, in_num, index, num_added);
+}
+
+int
+virtio_scsi_process_op(struct disk_op_s *op)
+{
+    if (! CONFIG_VIRTIO_SCSI)
+        return 0;
+    struct virtio_lun_s *vlun =
+        container_of(op->drive_fl, struct virtio_lun_s, drive);
+    struct vp_device *vp = vlun->vp;
+    struct vring_virtqueue *vq = vlun->vq;
+    struct virtio_scsi_reqs_s *reqs = vlun->reqs;
+    struct virtio_scsi_cmd_s *cmds = reqs->cmds;
+
+    mutex_lock(&reqs->lock);
+    int blocksize = scsi_fill_cmd(op, cmds[0].req.cdb, 16);
+    if (blocksize < 0) {
+        mutex_unlock(&reqs->lock);
+        return default_process_op(op);
+    }
+
+    /* Split large reads/writes so several requests are in flight */
+    int maxreqs = VIRTIO_SCSI_MAX_REQS;
+    if (maxreqs > vq->vring.num / 3)
+        maxreqs = vq->vring.num / 3;
+    u16 chunk = scsi_split_count(op, blocksize, maxreqs);
+    u16 counts[VIRTIO_SCSI_MAX_REQS];
+    struct disk_op_s sub = *op;
+    int num = 0;
+    u32 done = 0;
+    for (;;) {
+        sub.count = op->count - done;
+        if (sub.count > chunk)
+            sub.count = chunk;
+        if (num) {
+            sub.lba = op->lba + done;
+            sub.buf_fl = op->buf_fl + done * blocksize;
+        }
+        virtio_scsi_add_req(vlun, &cmds[num], &sub, blocksize, num, num);
+        counts[num++] = sub.count;
+        done += sub.count;
+        if (done >= op->count)
+            break;
+    }
 
-    /* Wait for reply */
-    while (!vring_more_used(vq))
-        usleep(5);
+    /* Kick host once for all requests */
+    vring_kick(vp, vq, num);
 
-    /* Reclaim virtqueue element */
-    vring_get_buf(vq, NULL);
+    /* Wait for replies and reclaim virtqueue elements */
+    int i;
+    for (i = 0; i < num; i++) {
+        while (!vring_more_used(vq))
+            usleep(5);
+        vring_get_buf(vq, NULL);
+    }
 
     /* Clear interrupt status register.  Avoid leaving interrupts stuck if
      * VRING_AVAIL_F_NO_INTERRUPT was ignored and interrupts were raised.
      */
     vp_get_isr(vp);
 
-    if (resp.response == VIRTIO_SCSI_S_OK && resp.status == 0) {
-        return DISK_RET_SUCCESS;
+    /* Check results in submission order */
+    done = 0;
+    for (i = 0; i < num; i++) {
+        struct virtio_scsi_resp_cmd *resp = &cmds[i].resp;
+        if (resp->response != VIRTIO_SCSI_S_OK || resp->status != 0)
+            break;
+        done += counts[i];
     }
+    mutex_unlock(&reqs->lock);
+    if (i == num)
+        return DISK_RET_SUCCESS;
+    if (num > 1)
+        op->count = done;
     return DISK_RET_EBADTRACK;
 }
 
@@ -100,7 +169,7 @@ static void
 virtio_scsi_init_lun(struct virtio_lun_s *vlun,
                      struct pci_device *pci, void *mmio,
                      struct vp_device *vp, struct vring_virtqueue *vq,
-                     u16 target, u16 lun)
+                     struct virtio_scsi_reqs_s *reqs, u16 target, u16 lun)
 {
     memset(vlun, 0, sizeof(*vlun));
     vlun->drive.type = DTYPE_VIRTIO_SCSI;
@@ -109,6 +178,7 @@ virtio_scsi_init_lun(struct virtio_lun_s *vlun,
     vlun->mmio = mmio;
     vlun->vp = vp;
     vlun->vq = vq;
+    vlun->reqs = reqs;
     vlun->target = target;
     vlun->lun = lun;
     if (vlun->pci)
@@ -143,12 +213,14 @@ virtio_scsi_add_lun(u32 lun, struct drive_s *tmpl_drv)
         return -1;
     }
     virtio_scsi_init_lun(vlun, tmpl_vlun->pci, tmpl_vlun->mmio,tmpl_vlun->vp,
-                         tmpl_vlun->vq, tmpl_vlun->target, lun);
+                         tmpl_vlun->vq, tmpl_vlun->reqs, tmpl_vlun->target,
+                         lun);
 
     if (vlun->pci)
         boot_lchs_find_scsi_device(vlun->pci, vlun->target, vlun->lun,
                                    &(vlun->drive.lchs));
-    int ret = scsi_drive_setup(&vlun->drive, "virtio-scsi", prio);
+    int ret = scsi_drive_setup_until(&vlun->drive, "virtio-scsi", prio
+                                     , tmpl_vlun->ready_end);
     if (ret)
         goto fail;
     return 0;
@@ -159,13 +231,15 @@ fail:
 }
 
 static int
-virtio_scsi_scan_target(struct pci_device *pci, void *mmio, struct vp_device *vp,
-                        struct vring_virtqueue *vq, u16 target)
+virtio_scsi_scan_target(void *data, int target, u32 ready_end)
 {
-
+    struct virtio_lun_s *tmpl_vlun = data;
     struct virtio_lun_s vlun0;
 
-    virtio_scsi_init_lun(&vlun0, pci, mmio, vp, vq, target, 0);
+    virtio_scsi_init_lun(&vlun0, tmpl_vlun->pci, tmpl_vlun->mmio,
+                         tmpl_vlun->vp, tmpl_vlun->vq, tmpl_vlun->reqs,
+                         target, 0);
+    vlun0.ready_end = ready_end;
 
     int ret = scsi_rep_luns_scan(&vlun0.drive, virtio_scsi_add_lun);
     return ret < 0 ? 0 : ret;
@@ -178,10 +252,14 @@ init_virtio_scsi(void *data)
     dprintf(1, "found virtio-scsi at %pP\n", pci);
     struct vring_virtqueue *vq = NULL;
     struct vp_device *vp = malloc_high(sizeof(*vp));
-    if (!vp) {
+    struct virtio_scsi_reqs_s *reqs = malloc_high(sizeof(*reqs));
+    if (!vp || !reqs) {
         warn_noalloc();
+        free(vp);
+        free(reqs);
         return;
     }
+    memset(reqs, 0, sizeof(*reqs));
     vp_init_simple(vp, pci);
     u8 status = VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER;
 
@@ -211,9 +289,9 @@ init_virtio_scsi(void *data)
     status |= VIRTIO_CONFIG_S_DRIVER_OK;
     vp_set_status(vp, status);
 
-    int i, tot;
-    for (tot = 0, i = 0; i < 256; i++)
-        tot += virtio_scsi_scan_target(pci, NULL, vp, vq, i);
+    struct virtio_lun_s tmpl_vlun;
+    virtio_scsi_init_lun(&tmpl_vlun, pci, NULL, vp, vq, reqs, 0, 0);
+    int tot = scsi_scan_targets(&tmpl_vlun, 256, virtio_scsi_scan_target);
 
     if (!tot)
         goto fail;
@@ -224,6 +302,7 @@ fail:
     vp_reset(vp);
     free(vp);
     free(vq);
+    free(reqs);
 }
 
 void
@@ -232,10 +311,14 @@ init_virtio_scsi_mmio(void *mmio)
     dprintf(1, "found virtio-scsi-mmio at %p\n", mmio);
     struct vring_virtqueue *vq = NULL;
     struct vp_device *vp = malloc_high(sizeof(*vp));
-    if (!vp) {
+    struct virtio_scsi_reqs_s *reqs = malloc_high(sizeof(*reqs));
+    if (!vp || !reqs) {
         warn_noalloc();
+        free(vp);
+        free(reqs);
         return;
     }
+    memset(reqs, 0, sizeof(*reqs));
     vp_init_mmio(vp, mmio);
     u8 status = VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER;
 
@@ -260,9 +343,9 @@ init_virtio_scsi_mmio(void *mmio)
     status |= VIRTIO_CONFIG_S_DRIVER_OK;
     vp_set_status(vp, status);
 
-    int i, tot;
-    for (tot = 0, i = 0; i < 256; i++)
-        tot += virtio_scsi_scan_target(NULL, mmio, vp, vq, i);
+    struct virtio_lun_s tmpl_vlun;
+    virtio_scsi_init_lun(&tmpl_vlun, NULL, mmio, vp, vq, reqs, 0, 0);
+    int tot = scsi_scan_targets(&tmpl_vlun, 256, virtio_scsi_scan_target);
 
     if (!tot)
         goto fail;
@@ -273,6 +356,7 @@ fail:
     vp_reset(vp);
     free(vp);
     free(vq);
+    free(reqs);
 }
 
 void
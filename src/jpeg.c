@@ -43,6 +43,7 @@
 #include "malloc.h"
 #include "string.h"
 #include "util.h"
+#include "x86.h"
 #define ISHIFT 11
 
 #define IFIX(a) ((int)((a) * (1 << ISHIFT) + .5))
@@ -117,9 +118,9 @@ static void scaleidctqtab __P((PREC *, PREC));
 
 static void initcol __P((PREC[][64]));
 
-static void col221111 __P((int *, unsigned char *, int));
-static void col221111_16 __P((int *, unsigned char *, int));
-static void col221111_32 __P((int *, unsigned char *, int));
+typedef void (*colrow_fn) __P((short *, short *, short *, unsigned char *,
+                               int, int));
+static colrow_fn colrow_select __P((int, int));
 
 /*********************************/
 
@@ -138,6 +139,7 @@ static void col221111_32 __P((int *, unsigned char *, int));
 #define ERR_NO_EOI 13
 #define ERR_BAD_TABLES 14
 #define ERR_DEPTH_MISMATCH 15
+#define ERR_NO_MEMORY 16
 
 /*********************************/
 
@@ -168,6 +170,11 @@ struct jpginfo {
 };
 
 struct jpeg_decdata {
+    /* one line of the current mcu, chroma upsampled to luma size */
+    short rowy[16] __aligned(16);
+    short rowcb[16] __aligned(16);
+    short rowcr[16] __aligned(16);
+
     int dcts[6 * 64 + 16];
     int out[64 * 6];
     int dquant[3][64];
@@ -181,6 +188,7 @@ struct jpeg_decdata {
     struct in in;
 
     int height, width;
+    int yh, yv;           /* luma blocks per mcu (horiz/vert) */
 };
 
 static int getbyte(struct jpeg_decdata *jpeg)
@@ -315,8 +323,6 @@ int jpeg_decode(struct jpeg_decdata *jpeg, unsigned char *buf)
         return ERR_NOT_8BIT;
     jpeg->height = getword(jpeg);
     jpeg->width = getword(jpeg);
-    if ((jpeg->height & 15) || (jpeg->width & 15))
-        return ERR_BAD_WIDTH_OR_HEIGHT;
     jpeg->info.nc = getbyte(jpeg);
     if (jpeg->info.nc > MAXCOMP)
         return ERR_TOO_MANY_COMPPS;
@@ -367,9 +373,15 @@ int jpeg_decode(struct jpeg_decdata *jpeg, unsigned char *buf)
         || jpeg->dscans[2].cid != 3)
         return ERR_NOT_YCBCR_221111;
 
-    if (jpeg->dscans[0].hv != 0x22 || jpeg->dscans[1].hv != 0x11
-        || jpeg->dscans[2].hv != 0x11)
+    /* 4:2:0, 4:2:2 and 4:4:4 subsampling are supported */
+    if ((jpeg->dscans[0].hv != 0x22 && jpeg->dscans[0].hv != 0x21
+         && jpeg->dscans[0].hv != 0x11)
+        || jpeg->dscans[1].hv != 0x11 || jpeg->dscans[2].hv != 0x11)
         return ERR_NOT_YCBCR_221111;
+    jpeg->yh = jpeg->dscans[0].hv >> 4;
+    jpeg->yv = jpeg->dscans[0].hv & 15;
+    if (jpeg->width % (jpeg->yh * 8) || jpeg->height % (jpeg->yv * 8))
+        return ERR_BAD_WIDTH_OR_HEIGHT;
 
     idctqtab(jpeg->quant[jpeg->dscans[0].tq], jpeg->dquant[0]);
     idctqtab(jpeg->quant[jpeg->dscans[1].tq], jpeg->dquant[1]);
@@ -395,74 +407,168 @@ void jpeg_get_size(struct jpeg_decdata *jpeg, int *width, int *height)
     *height = jpeg->height;
 }
 
+#define JPEG_MAX_SCALE 3   /* downscale by up to 1/8 */
+
+#define OUTY(jpeg, i, j) \
+  (jpeg)->out[(((j) >> 3) * (jpeg)->yh + ((i) >> 3)) * 64 + ((j) & 7) * 8 + ((i) & 7)]
+#define OUTC(jpeg, c, i, j) \
+  (jpeg)->out[((jpeg)->yh * (jpeg)->yv + (c)) * 64 \
+              + ((j) >> ((jpeg)->yv - 1)) * 8 + ((i) >> ((jpeg)->yh - 1))]
+
+/*
+ * Gather line 'l' of the current mcu into the y/cb/cr rows, downscaled
+ * by 1 << 'sc'.  Each output pixel is the average of the samples it
+ * covers.  At 1/8 scale only the DC terms of the luma blocks (and of
+ * the chroma blocks when not subsampled) are decoded, so those blocks
+ * are flat and a single sample is enough.
+ */
+static void mcurow(struct jpeg_decdata *jpeg, int l, int sc)
+{
+    int x, n, i, j, lb, cbh, cbv, sy, scb, scr, cx, cy;
+    int *outc;
+
+    n = (jpeg->yh * 8) >> sc;
+    if (!sc) {
+        for (x = 0; x < n; x++) {
+            jpeg->rowy[x] = OUTY(jpeg, x, l);
+            jpeg->rowcb[x] = OUTC(jpeg, 0, x, l);
+            jpeg->rowcr[x] = OUTC(jpeg, 1, x, l);
+        }
+        return;
+    }
+
+    /* log2 of the averaged box size in luma and chroma samples */
+    lb = sc < JPEG_MAX_SCALE ? sc : 0;
+    cbh = sc - (jpeg->yh - 1);
+    cbv = sc - (jpeg->yv - 1);
+    if (sc == JPEG_MAX_SCALE && jpeg->yh * jpeg->yv == 1)
+        cbh = cbv = 0;
+    outc = jpeg->out + jpeg->yh * jpeg->yv * 64;
+    for (x = 0; x < n; x++) {
+        sy = scb = scr = 0;
+        for (j = l << sc; j < (l << sc) + (1 << lb); j++)
+            for (i = x << sc; i < (x << sc) + (1 << lb); i++)
+                sy += OUTY(jpeg, i, j);
+        cy = (l << sc) >> (jpeg->yv - 1);
+        cx = (x << sc) >> (jpeg->yh - 1);
+        for (j = cy; j < cy + (1 << cbv); j++)
+            for (i = cx; i < cx + (1 << cbh); i++) {
+                scb += outc[j * 8 + i];
+                scr += outc[64 + j * 8 + i];
+            }
+        jpeg->rowy[x] = (sy + (1 << 2 * lb >> 1)) >> (2 * lb);
+        jpeg->rowcb[x] = (scb + (1 << (cbh + cbv) >> 1)) >> (cbh + cbv);
+        jpeg->rowcr[x] = (scr + (1 << (cbh + cbv) >> 1)) >> (cbh + cbv);
+    }
+}
+
+// Decode the picture to 'pic' (which may be a video framebuffer) of the
+// given size.  A picture larger than the destination is downscaled by
+// 1/2, 1/4 or 1/8 until it fits, and the result is centred.  Each row
+// of MCUs is decoded into a small strip buffer and then copied to its
+// final location, so the full picture is never staged in memory.
 int jpeg_show(struct jpeg_decdata *jpeg, unsigned char *pic, int width
               , int height, int depth, int bytes_per_line_dest)
 {
-    int m, mcusx, mcusy, mx, my, mloffset, jpgbpl;
+    int m, mcusx, mcusy, mx, my, mloffset, jpgbpl, i, l, ret;
+    int nblocks, mcuw, mcuh, sse2, sc, sw, sh, stripw, striph;
     int max[6];
+    unsigned char *strip;
+    u32 cr4;
+    colrow_fn colrow;
 
-    if (jpeg->height != height)
+    for (sc = 0; sc <= JPEG_MAX_SCALE; sc++)
+        if ((jpeg->width >> sc) <= width && (jpeg->height >> sc) <= height)
+            break;
+    if ((jpeg->height >> JPEG_MAX_SCALE) > height)
         return ERR_HEIGHT_MISMATCH;
-    if (jpeg->width != width)
+    if (sc > JPEG_MAX_SCALE)
         return ERR_WIDTH_MISMATCH;
-
-    jpgbpl = width * depth / 8;
-    mloffset = bytes_per_line_dest > jpgbpl ? bytes_per_line_dest : jpgbpl;
-
-    mcusx = jpeg->width >> 4;
-    mcusy = jpeg->height >> 4;
-
-    jpeg->dscans[0].next = 6 - 4;
-    jpeg->dscans[1].next = 6 - 4 - 1;
-    jpeg->dscans[2].next = 6 - 4 - 1 - 1;        /* 411 encoding */
+    if (depth != 16 && depth != 24 && depth != 32)
+        return ERR_DEPTH_MISMATCH;
+
+    sw = jpeg->width >> sc;
+    sh = jpeg->height >> sc;
+    jpgbpl = sw * depth / 8;
+    mloffset = width * depth / 8;
+    if (bytes_per_line_dest > mloffset)
+        mloffset = bytes_per_line_dest;
+    pic += (height - sh) / 2 * mloffset + (width - sw) / 2 * depth / 8;
+
+    strip = malloc_tmphigh(16 * jpgbpl);
+    if (!strip)
+        return ERR_NO_MEMORY;
+
+    nblocks = jpeg->yh * jpeg->yv;
+    mcuw = jpeg->yh * 8;
+    mcuh = jpeg->yv * 8;
+    mcusx = jpeg->width / mcuw;
+    mcusy = jpeg->height / mcuh;
+    stripw = mcuw >> sc;
+    striph = mcuh >> sc;
+
+    /* SSE2 colour conversion if the cpu supports it */
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    sse2 = (edx & CPUID_SSE2) && !(stripw & 7);
+
+    /* luma blocks followed by one cb and one cr block */
+    jpeg->dscans[0].next = 2;
+    jpeg->dscans[1].next = 1;
+    jpeg->dscans[2].next = 0;
+    ret = 0;
     for (my = 0; my < mcusy; my++) {
+        cr4 = sse2 ? sse_enter() : 0;
+        colrow = colrow_select(depth, !!cr4);
         for (mx = 0; mx < mcusx; mx++) {
             if (jpeg->info.dri && !--jpeg->info.nm)
-                if (dec_checkmarker(jpeg))
-                    return ERR_WRONG_MARKER;
-
-            decode_mcus(&jpeg->in, jpeg->dcts, 6, jpeg->dscans, max);
-            idct(jpeg->dcts, jpeg->out, jpeg->dquant[0],
-                 IFIX(128.5), max[0]);
-            idct(jpeg->dcts + 64, jpeg->out + 64, jpeg->dquant[0],
-                 IFIX(128.5), max[1]);
-            idct(jpeg->dcts + 128, jpeg->out + 128, jpeg->dquant[0],
-                 IFIX(128.5), max[2]);
-            idct(jpeg->dcts + 192, jpeg->out + 192, jpeg->dquant[0],
-                 IFIX(128.5), max[3]);
-            idct(jpeg->dcts + 256, jpeg->out + 256, jpeg->dquant[1],
-                 IFIX(0.5), max[4]);
-            idct(jpeg->dcts + 320, jpeg->out + 320, jpeg->dquant[2],
-                 IFIX(0.5), max[5]);
-
-            switch (depth) {
-            case 32:
-                col221111_32(jpeg->out,
-                             pic + (my * 16 * mloffset + mx * 16 * 4),
-                             mloffset);
-                break;
-            case 24:
-                col221111(jpeg->out,
-                          pic + (my * 16 * mloffset + mx * 16 * 3),
-                          mloffset);
-                break;
-            case 16:
-                col221111_16(jpeg->out,
-                             pic + (my * 16 * mloffset + mx * 16 * 2),
-                             mloffset);
-                break;
-            default:
-                return ERR_DEPTH_MISMATCH;
-                break;
+                if (dec_checkmarker(jpeg)) {
+                    ret = ERR_WRONG_MARKER;
+                    break;
+                }
+
+            decode_mcus(&jpeg->in, jpeg->dcts, nblocks + 2, jpeg->dscans,
+                        max);
+            if (sc == JPEG_MAX_SCALE)
+                /* only the DC terms are needed (see mcurow) */
+                for (i = 0; i < (nblocks == 1 ? 3 : nblocks); i++)
+                    max[i] = 1;
+            for (i = 0; i < nblocks; i++)
+                idct(jpeg->dcts + i * 64, jpeg->out + i * 64,
+                     jpeg->dquant[0], IFIX(128.5), max[i]);
+            idct(jpeg->dcts + i * 64, jpeg->out + i * 64, jpeg->dquant[1],
+                 IFIX(0.5), max[i]);
+            i++;
+            idct(jpeg->dcts + i * 64, jpeg->out + i * 64, jpeg->dquant[2],
+                 IFIX(0.5), max[i]);
+
+            for (l = 0; l < striph; l++) {
+                mcurow(jpeg, l, sc);
+                colrow(jpeg->rowy, jpeg->rowcb, jpeg->rowcr,
+                       strip + l * jpgbpl + mx * stripw * depth / 8,
+                       stripw, l);
             }
         }
+        if (cr4)
+            sse_leave(cr4);
+        if (ret)
+            goto done;
+
+        /* flush the completed MCU row */
+        if (mloffset == jpgbpl)
+            iomemcpy(pic + my * striph * mloffset, strip, striph * jpgbpl);
+        else
+            for (l = 0; l < striph; l++)
+                iomemcpy(pic + (my * striph + l) * mloffset
+                         , strip + l * jpgbpl, jpgbpl);
     }
 
     m = dec_readmarker(&jpeg->in);
     if (m != M_EOI)
-        return ERR_NO_EOI;
-
-    return 0;
+        ret = ERR_NO_EOI;
+done:
+    free(strip);
+    return ret;
 }
 
 /****************************************************************/
@@ -756,7 +862,10 @@ static void idct(int *in, int *out, PREC * quant, PREC off, int max)
         t3 = in[j] * quant[j];
         j = *zig2p++;
         t6 = in[j] * quant[j];
-        IDCT;
+        if (t1 | t2 | t3 | t4 | t5 | t6 | t7)
+            IDCT;
+        else                     /* no AC terms, all outputs are the DC */
+            t1 = t2 = t3 = t4 = t5 = t6 = t7 = t0;
         tmpp[0 * 8] = t0;
         tmpp[1 * 8] = t1;
         tmpp[2 * 8] = t2;
@@ -777,7 +886,10 @@ static void idct(int *in, int *out, PREC * quant, PREC off, int max)
         t5 = tmp[8 * i + 5];
         t6 = tmp[8 * i + 6];
         t7 = tmp[8 * i + 7];
-        IDCT;
+        if (t1 | t2 | t3 | t4 | t5 | t6 | t7)
+            IDCT;
+        else
+            t1 = t2 = t3 = t4 = t5 = t6 = t7 = t0;
         out[8 * i + 0] = ITOINT(t0);
         out[8 * i + 1] = ITOINT(t1);
         out[8 * i + 2] = ITOINT(t2);
@@ -873,183 +985,222 @@ static void initcol(PREC q[][64])
 
 #ifdef ROUND
 
-#define CBCRCG(yin, xin)                         \
+#define CBCRCG(xin)                              \
 (                                                \
-  cb = outc[0 +yin*8+xin],                       \
-  cr = outc[64+yin*8+xin],                       \
+  cb = pcb[xin],                                 \
+  cr = pcr[xin],                                 \
   cg = (50 * cb + 130 * cr + 128) >> 8           \
 )
 
 #else
 
-#define CBCRCG(yin, xin)                         \
+#define CBCRCG(xin)                              \
 (                                                \
-  cb = outc[0 +yin*8+xin],                       \
-  cr = outc[64+yin*8+xin],                       \
+  cb = pcb[xin],                                 \
+  cr = pcr[xin],                                 \
   cg = (3 * cb + 8 * cr) >> 4                    \
 )
 
 #endif
 
 #ifdef __LITTLE_ENDIAN
-#define PIC(yin, xin, p, xout)                   \
+#define PIC(xin, p)                              \
 (                                                \
-  y = outy[(yin) * 8 + xin],                     \
-  STORECLAMP(p[(xout) * 3 + 2], y + cr),         \
-  STORECLAMP(p[(xout) * 3 + 1], y - cg),         \
-  STORECLAMP(p[(xout) * 3 + 0], y + cb)          \
+  y = py[xin],                                   \
+  STORECLAMP(p[(xin) * 3 + 2], y + cr),          \
+  STORECLAMP(p[(xin) * 3 + 1], y - cg),          \
+  STORECLAMP(p[(xin) * 3 + 0], y + cb)           \
 )
 #else
-#define PIC(yin, xin, p, xout)                   \
+#define PIC(xin, p)                              \
 (                                                \
-  y = outy[(yin) * 8 + xin],                     \
-  STORECLAMP(p[(xout) * 3 + 0], y + cr),         \
-  STORECLAMP(p[(xout) * 3 + 1], y - cg),         \
-  STORECLAMP(p[(xout) * 3 + 2], y + cb)          \
+  y = py[xin],                                   \
+  STORECLAMP(p[(xin) * 3 + 0], y + cr),          \
+  STORECLAMP(p[(xin) * 3 + 1], y - cg),          \
+  STORECLAMP(p[(xin) * 3 + 2], y + cb)           \
 )
 #endif
 
 #ifdef __LITTLE_ENDIAN
-#define PIC_16(yin, xin, p, xout, add)           \
+#define PIC_16(xin, p, add)                      \
 (                                                \
-  y = outy[(yin) * 8 + xin],                     \
+  y = py[xin],                                   \
   y = ((CLAMP(y + cr + add*2+1) & 0xf8) <<  8) | \
       ((CLAMP(y - cg + add    ) & 0xfc) <<  3) | \
       ((CLAMP(y + cb + add*2+1)       ) >>  3),  \
-  p[(xout) * 2 + 0] = y & 0xff,                  \
-  p[(xout) * 2 + 1] = y >> 8                     \
+  p[(xin) * 2 + 0] = y & 0xff,                   \
+  p[(xin) * 2 + 1] = y >> 8                      \
 )
 #else
 #ifdef CONFIG_PPC
-#define PIC_16(yin, xin, p, xout, add)           \
+#define PIC_16(xin, p, add)                      \
 (                                                \
-  y = outy[(yin) * 8 + xin],                     \
+  y = py[xin],                                   \
   y = ((CLAMP(y + cr + add*2+1) & 0xf8) <<  7) | \
       ((CLAMP(y - cg + add*2+1) & 0xf8) <<  2) | \
       ((CLAMP(y + cb + add*2+1)       ) >>  3),  \
-  p[(xout) * 2 + 0] = y >> 8,                    \
-  p[(xout) * 2 + 1] = y & 0xff                   \
+  p[(xin) * 2 + 0] = y >> 8,                     \
+  p[(xin) * 2 + 1] = y & 0xff                    \
 )
 #else
-#define PIC_16(yin, xin, p, xout, add)           \
+#define PIC_16(xin, p, add)                      \
 (                                                \
-  y = outy[(yin) * 8 + xin],                     \
+  y = py[xin],                                   \
   y = ((CLAMP(y + cr + add*2+1) & 0xf8) <<  8) | \
       ((CLAMP(y - cg + add    ) & 0xfc) <<  3) | \
       ((CLAMP(y + cb + add*2+1)       ) >>  3),  \
-  p[(xout) * 2 + 0] = y >> 8,                    \
-  p[(xout) * 2 + 1] = y & 0xff                   \
+  p[(xin) * 2 + 0] = y >> 8,                     \
+  p[(xin) * 2 + 1] = y & 0xff                    \
 )
 #endif
 #endif
 
-#define PIC_32(yin, xin, p, xout)               \
-(                                               \
-  y = outy[(yin) * 8 + xin],                    \
-  STORECLAMP(p[(xout) * 4 + 0], y + cr),        \
-  STORECLAMP(p[(xout) * 4 + 1], y - cg),        \
-  STORECLAMP(p[(xout) * 4 + 2], y + cb),        \
-  p[(xout) * 4 + 3] = 0                         \
+#define PIC_32(xin, p)                           \
+(                                                \
+  y = py[xin],                                   \
+  STORECLAMP(p[(xin) * 4 + 0], y + cr),          \
+  STORECLAMP(p[(xin) * 4 + 1], y - cg),          \
+  STORECLAMP(p[(xin) * 4 + 2], y + cb),          \
+  p[(xin) * 4 + 3] = 0                           \
 )
 
-#define PIC221111(xin)                                              \
-(                                                                   \
-  CBCRCG(0, xin),                                                   \
-  PIC(xin / 4 * 8 + 0, (xin & 3) * 2 + 0, pic0, xin * 2 + 0),       \
-  PIC(xin / 4 * 8 + 0, (xin & 3) * 2 + 1, pic0, xin * 2 + 1),       \
-  PIC(xin / 4 * 8 + 1, (xin & 3) * 2 + 0, pic1, xin * 2 + 0),       \
-  PIC(xin / 4 * 8 + 1, (xin & 3) * 2 + 1, pic1, xin * 2 + 1)        \
-)
+/* 16bpp dither offsets, indexed by line and column parity */
+static unsigned char dith16[2][2] = { { 3, 0 }, { 1, 2 } };
 
-#define PIC221111_16(xin)                                           \
-(                                                                   \
-  CBCRCG(0, xin),                                                   \
-  PIC_16(xin / 4 * 8 + 0, (xin & 3) * 2 + 0, pic0, xin * 2 + 0, 3), \
-  PIC_16(xin / 4 * 8 + 0, (xin & 3) * 2 + 1, pic0, xin * 2 + 1, 0), \
-  PIC_16(xin / 4 * 8 + 1, (xin & 3) * 2 + 0, pic1, xin * 2 + 0, 1), \
-  PIC_16(xin / 4 * 8 + 1, (xin & 3) * 2 + 1, pic1, xin * 2 + 1, 2)  \
-)
+static void colrow_24(short *py, short *pcb, short *pcr, unsigned char *p,
+                   int n, int line)
+{
+    int x, cr, cg, cb, y;
 
-#define PIC221111_32(xin)                                           \
-(                                                                   \
-  CBCRCG(0, xin),                                                   \
-  PIC_32(xin / 4 * 8 + 0, (xin & 3) * 2 + 0, pic0, xin * 2 + 0),    \
-  PIC_32(xin / 4 * 8 + 0, (xin & 3) * 2 + 1, pic0, xin * 2 + 1),    \
-  PIC_32(xin / 4 * 8 + 1, (xin & 3) * 2 + 0, pic1, xin * 2 + 0),    \
-  PIC_32(xin / 4 * 8 + 1, (xin & 3) * 2 + 1, pic1, xin * 2 + 1)     \
-)
+    for (x = 0; x < n; x++) {
+        CBCRCG(x);
+        PIC(x, p);
+    }
+}
 
-static void col221111(int *out, unsigned char *pic, int width)
+static void colrow_16(short *py, short *pcb, short *pcr, unsigned char *p,
+                      int n, int line)
 {
-    int i, j, k;
-    unsigned char *pic0, *pic1;
-    int *outy, *outc;
-    int cr, cg, cb, y;
-
-    pic0 = pic;
-    pic1 = pic + width;
-    outy = out;
-    outc = out + 64 * 4;
-    for (i = 2; i > 0; i--) {
-        for (j = 4; j > 0; j--) {
-            for (k = 0; k < 8; k++) {
-                PIC221111(k);
-            }
-            outc += 8;
-            outy += 16;
-            pic0 += 2 * width;
-            pic1 += 2 * width;
-        }
-        outy += 64 * 2 - 16 * 4;
+    int x, cr, cg, cb, y;
+    unsigned char *add = dith16[line & 1];
+
+    for (x = 0; x < n; x++) {
+        CBCRCG(x);
+        PIC_16(x, p, add[x & 1]);
     }
 }
 
-static void col221111_16(int *out, unsigned char *pic, int width)
+static void colrow_32(short *py, short *pcb, short *pcr, unsigned char *p,
+                      int n, int line)
 {
-    int i, j, k;
-    unsigned char *pic0, *pic1;
-    int *outy, *outc;
-    int cr, cg, cb, y;
-
-    pic0 = pic;
-    pic1 = pic + width;
-    outy = out;
-    outc = out + 64 * 4;
-    for (i = 2; i > 0; i--) {
-        for (j = 4; j > 0; j--) {
-            for (k = 0; k < 8; k++) {
-                PIC221111_16(k);
-            }
-            outc += 8;
-            outy += 16;
-            pic0 += 2 * width;
-            pic1 += 2 * width;
-        }
-        outy += 64 * 2 - 16 * 4;
+    int x, cr, cg, cb, y;
+
+    for (x = 0; x < n; x++) {
+        CBCRCG(x);
+        PIC_32(x, p);
     }
 }
 
-static void col221111_32(int *out, unsigned char *pic, int width)
+/****************************************************************/
+/**************       SSE2 color decoder          ***************/
+/****************************************************************/
+
+/*
+ * The same conversion as above, eight pixels at a time.  The rows are
+ * converted with 16 bit lanes and clamped by the saturating packs.
+ * These are only called between sse_enter() and sse_leave().
+ */
+
+#define SSE2 __attribute__((target("sse2")))
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+
+static inline SSE2 void sse2_rgb(short *py, short *pcb, short *pcr,
+                                 v8hi *r, v8hi *g, v8hi *b)
 {
-    int i, j, k;
-    unsigned char *pic0, *pic1;
-    int *outy, *outc;
-    int cr, cg, cb, y;
-
-    pic0 = pic;
-    pic1 = pic + width;
-    outy = out;
-    outc = out + 64 * 4;
-    for (i = 2; i > 0; i--) {
-        for (j = 4; j > 0; j--) {
-            for (k = 0; k < 8; k++) {
-                PIC221111_32(k);
-            }
-            outc += 8;
-            outy += 16;
-            pic0 += 2 * width;
-            pic1 += 2 * width;
+    const v8hi cgmul = { 50, 130, 50, 130, 50, 130, 50, 130 };
+    const v4si round = { 128, 128, 128, 128 };
+    v8hi y = *(v8hi *)py, cb = *(v8hi *)pcb, cr = *(v8hi *)pcr;
+    v4si lo, hi;
+
+    lo = __builtin_ia32_pmaddwd128(__builtin_ia32_punpcklwd128(cb, cr),
+                                   cgmul) + round;
+    hi = __builtin_ia32_pmaddwd128(__builtin_ia32_punpckhwd128(cb, cr),
+                                   cgmul) + round;
+    *r = y + cr;
+    *g = y - __builtin_ia32_packssdw128(lo >> 8, hi >> 8);
+    *b = y + cb;
+}
+
+#define CLAMP8(x) __builtin_ia32_packuswb128((x), (x))
+
+static SSE2 void colrow_24_sse2(short *py, short *pcb, short *pcr,
+                             unsigned char *p, int n, int line)
+{
+    unsigned char rgb[3][16] __aligned(16);
+    v8hi r, g, b;
+    int x;
+
+    for (; n > 0; n -= 8, py += 8, pcb += 8, pcr += 8, p += 8 * 3) {
+        sse2_rgb(py, pcb, pcr, &r, &g, &b);
+        *(v16qi *)rgb[0] = CLAMP8(r);
+        *(v16qi *)rgb[1] = CLAMP8(g);
+        *(v16qi *)rgb[2] = CLAMP8(b);
+        for (x = 0; x < 8; x++) {
+            p[x * 3 + 2] = rgb[0][x];
+            p[x * 3 + 1] = rgb[1][x];
+            p[x * 3 + 0] = rgb[2][x];
         }
-        outy += 64 * 2 - 16 * 4;
+    }
+}
+
+static SSE2 void colrow_16_sse2(short *py, short *pcb, short *pcr,
+                                unsigned char *p, int n, int line)
+{
+    const v16qi zero = { 0 };
+    unsigned char *d = dith16[line & 1];
+    v8hi gadd = { d[0], d[1], d[0], d[1], d[0], d[1], d[0], d[1] };
+    v8hi rbadd = gadd * 2 + 1;
+    v8hi r, g, b;
+
+    for (; n > 0; n -= 8, py += 8, pcb += 8, pcr += 8, p += 8 * 2) {
+        sse2_rgb(py, pcb, pcr, &r, &g, &b);
+        r = (v8hi)__builtin_ia32_punpcklbw128(CLAMP8(r + rbadd), zero);
+        g = (v8hi)__builtin_ia32_punpcklbw128(CLAMP8(g + gadd), zero);
+        b = (v8hi)__builtin_ia32_punpcklbw128(CLAMP8(b + rbadd), zero);
+        __builtin_ia32_storedqu((char *)p, (v16qi)(((r & 0xf8) << 8)
+                                                   | ((g & 0xfc) << 3)
+                                                   | (b >> 3)));
+    }
+}
+
+static SSE2 void colrow_32_sse2(short *py, short *pcb, short *pcr,
+                                unsigned char *p, int n, int line)
+{
+    const v16qi zero = { 0 };
+    v8hi r, g, b, rg, b0;
+
+    for (; n > 0; n -= 8, py += 8, pcb += 8, pcr += 8, p += 8 * 4) {
+        sse2_rgb(py, pcb, pcr, &r, &g, &b);
+        rg = (v8hi)__builtin_ia32_punpcklbw128(CLAMP8(r), CLAMP8(g));
+        b0 = (v8hi)__builtin_ia32_punpcklbw128(CLAMP8(b), zero);
+        __builtin_ia32_storedqu((char *)p,
+                                (v16qi)__builtin_ia32_punpcklwd128(rg, b0));
+        __builtin_ia32_storedqu((char *)p + 16,
+                                (v16qi)__builtin_ia32_punpckhwd128(rg, b0));
+    }
+}
+
+static colrow_fn colrow_select(int depth, int sse2)
+{
+    switch (depth) {
+    case 32:
+        return sse2 ? colrow_32_sse2 : colrow_32;
+    case 24:
+        return sse2 ? colrow_24_sse2 : colrow_24;
+    default:
+        return sse2 ? colrow_16_sse2 : colrow_16;
     }
 }
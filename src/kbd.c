@@ -54,6 +54,7 @@ enqueue_key(u16 keycode)
 static void
 dequeue_key(struct bregs *regs, int incr, int extended)
 {
+    sercon_check_event();
     yield();
     u16 buffer_head;
     u16 buffer_tail;
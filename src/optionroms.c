@@ -46,6 +46,8 @@ __callrom(struct rom_header *rom, u16 offset, u16 bdf)
     br.es = SEG_BIOS;
     br.di = get_pnp_offset();
     br.code = SEGOFF(seg, offset);
+    // The rom may use the TPM - queued PCR extends must reach it first
+    tpm_extend_drain();
     start_preempt();
     farcall16big(&br);
     finish_preempt();
@@ -132,10 +134,7 @@ init_optionrom(struct rom_header *rom, u16 bdf, int isvga)
         warn_noalloc();
         return -1;
     }
-    if (newrom != rom)
-        memmove(newrom, rom, rom->size * 512);
-
-    tpm_option_rom(newrom, rom->size * 512);
+    tpm_copy_option_rom(newrom, rom, rom->size * 512);
 
     if (isvga || get_pnp_rom(newrom))
         // Only init vga and PnP roms here.
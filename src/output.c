@@ -23,6 +23,87 @@ struct putcinfo {
     void (*func)(struct putcinfo *info, char c);
 };
 
+// Start of a binary debug record (see bvrecord())
+#define DEBUG_RECORD_MARK 0x1e
+// Escape for record bytes that a serial port or tty could alter
+#define DEBUG_RECORD_ESC 0x1f
+
+
+/****************************************************************
+ * Debug log ring
+ ****************************************************************/
+
+// Output from 32bit code can be collected in a log ring in memory and
+// sent to the debug ports in bulk.  The ring is allocated from
+// reserved memory, so it can be read by the OS after boot.
+#define DEBUG_RING_SIGNATURE 0x474f4c534f494253ULL // "SBIOSLOG"
+
+struct debug_ring_s {
+    u64 signature;
+    u32 size;   // size of data[]
+    u32 head;   // total number of characters logged
+    u32 tail;   // number of characters sent to the debug ports
+    u32 reserved;
+    char data[];
+};
+
+static struct debug_ring_s *DebugRing;
+
+void
+debug_ring_setup(void)
+{
+    if (!CONFIG_DEBUG_RING)
+        return;
+    u32 size = CONFIG_DEBUG_RING_SIZE * 1024;
+    struct debug_ring_s *ring = memalign_high(PAGE_SIZE, sizeof(*ring) + size);
+    if (!ring) {
+        warn_noalloc();
+        return;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->signature = DEBUG_RING_SIGNATURE;
+    ring->size = size;
+    DebugRing = ring;
+    dprintf(1, "Debug log ring at %p (%d bytes)\n", ring, size);
+}
+
+// Send all buffered output to the debug port(s).
+void
+debug_ring_drain(void)
+{
+    ASSERT32FLAT();
+    struct debug_ring_s *ring = DebugRing;
+    if (!CONFIG_DEBUG_RING || !ring || ring->tail == ring->head)
+        return;
+    while (ring->tail != ring->head) {
+        u32 pos = ring->tail % ring->size;
+        u32 len = ring->head - ring->tail;
+        if (len > ring->size - pos)
+            len = ring->size - pos;
+        char *s = &ring->data[pos];
+        qemu_debug_write(s, len);
+        u32 i;
+        for (i = 0; i < len; i++)
+            serial_debug_putc(s[i]);
+        ring->tail += len;
+    }
+    serial_debug_flush();
+}
+
+// Add a character to the log ring (if it is in use).
+static int
+debug_ring_putc(char c)
+{
+    struct debug_ring_s *ring = DebugRing;
+    if (!CONFIG_DEBUG_RING || !ring)
+        return 0;
+    if (ring->head - ring->tail >= ring->size)
+        debug_ring_drain();
+    ring->data[ring->head % ring->size] = c;
+    ring->head++;
+    return 1;
+}
+
 
 /****************************************************************
  * Debug output
@@ -41,9 +122,12 @@ debug_putc(struct putcinfo *action, char c)
 {
     if (! CONFIG_DEBUG_LEVEL)
         return;
-    qemu_debug_putc(c);
-    if (!MODESEGMENT)
+    if (!MODESEGMENT) {
         coreboot_debug_putc(c);
+        if (debug_ring_putc(c))
+            return;
+    }
+    qemu_debug_putc(c);
     serial_debug_putc(c);
 }
 
@@ -51,6 +135,9 @@ debug_putc(struct putcinfo *action, char c)
 static void
 debug_flush(void)
 {
+    if (!MODESEGMENT && CONFIG_DEBUG_RING && DebugRing)
+        // Output is in the log ring - the serial port is flushed on drain
+        return;
     serial_debug_flush();
 }
 
@@ -327,6 +414,123 @@ bvprintf(struct putcinfo *action, const char *fmt, va_list args)
     }
 }
 
+// Output a byte of a binary record.  Newlines (which the serial code
+// sends as "\r\n"), carriage returns and the record marker are sent
+// as an escape followed by the byte xor 0x20.
+static void
+putrec(struct putcinfo *action, u8 c)
+{
+    if (c == '\n' || c == '\r' || c == DEBUG_RECORD_MARK
+        || c == DEBUG_RECORD_ESC) {
+        putc(action, DEBUG_RECORD_ESC);
+        c ^= 0x20;
+    }
+    putc(action, c);
+}
+
+// Write the low 'len' bytes of a value (little endian).
+static void
+putraw(struct putcinfo *action, u32 val, int len)
+{
+    for (; len; len--, val >>= 8)
+        putrec(action, val);
+}
+
+// Write a nul terminated string to a binary record.  Strings in the
+// code segment are read with GET_GLOBAL (like puts_cs()).
+static void
+putrecstr(struct putcinfo *action, const char *s, int cs)
+{
+    if (!MODESEGMENT && !s)
+        s = "(NULL)";
+    for (;; s++) {
+        u8 c = cs ? GET_GLOBAL(*(u8*)s) : *s;
+        putrec(action, c);
+        if (!c)
+            break;
+    }
+}
+
+// Output a binary record describing a printf request.  The record
+// holds the address of the format string followed by the raw
+// arguments (strings are included nul terminated).  The message is
+// rendered later by scripts/decodelog.py using the format strings in
+// the build's rom.o.  Record bytes are escaped by putrec(), so records
+// survive the newline translation of the serial port.
+static void
+bvrecord(struct putcinfo *action, const char *fmt, va_list args)
+{
+    putc(action, DEBUG_RECORD_MARK);
+    // Segmented mode pointers are relative to the f-segment
+    putc(action, MODESEGMENT ? 'S' : 'F');
+    putraw(action, (u32)fmt, 4);
+    const char *s = fmt;
+    for (;; s++) {
+        char c = GET_GLOBAL(*(u8*)s);
+        if (!c)
+            break;
+        if (c != '%')
+            continue;
+        const char *n = s+1;
+        for (;;) {
+            c = GET_GLOBAL(*(u8*)n);
+            if (!isdigit(c))
+                break;
+            n++;
+        }
+        u8 is64 = 0;
+        if (c == 'l') {
+            n++;
+            c = GET_GLOBAL(*(u8*)n);
+        }
+        if (c == 'l') {
+            is64 = 1;
+            n++;
+            c = GET_GLOBAL(*(u8*)n);
+        }
+        u32 val;
+        switch (c) {
+        case 'd':
+        case 'u':
+        case 'X':
+        case 'x':
+            putraw(action, va_arg(args, u32), 4);
+            if (is64)
+                putraw(action, va_arg(args, u32), 4);
+            break;
+        case 'p':
+            val = va_arg(args, u32);
+            if (!MODESEGMENT && GET_GLOBAL(*(u8*)(n+1)) == 'P') {
+                // %pP is sent as the rendered device string (which
+                // never needs escaping)
+                put_pci_device(action, (void*)val);
+                putc(action, 0);
+                n++;
+                break;
+            }
+            putraw(action, val, 4);
+            break;
+        case 'c':
+            putrec(action, va_arg(args, int));
+            break;
+        case '.':
+            if (GET_GLOBAL(*(u8*)(n+1)) != 's')
+                break;
+            n++;
+            putrecstr(action, va_arg(args, const char *), 0);
+            break;
+        case 's':
+            putrecstr(action, va_arg(args, const char *), 1);
+            break;
+        case '%':
+            break;
+        default:
+            n = s;
+        }
+        s = n;
+    }
+}
+
 void
 panic(const char *fmt, ...)
 {
@@ -335,6 +539,8 @@ panic(const char *fmt, ...)
         va_start(args, fmt);
         bvprintf(&debuginfo, fmt, args);
         va_end(args);
+        if (!MODESEGMENT)
+            debug_ring_drain();
         debug_flush();
     }
 
@@ -361,7 +567,10 @@ __dprintf(const char *fmt, ...)
 
     va_list args;
     va_start(args, fmt);
-    bvprintf(&debuginfo, fmt, args);
+    if (CONFIG_DEBUG_RECORDS)
+        bvrecord(&debuginfo, fmt, args);
+    else
+        bvprintf(&debuginfo, fmt, args);
     va_end(args);
     debug_flush();
 }
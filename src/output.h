@@ -6,6 +6,8 @@
 
 // output.c
 void debug_banner(void);
+void debug_ring_setup(void);
+void debug_ring_drain(void);
 void panic(const char *fmt, ...)
     __attribute__ ((format (printf, 1, 2))) __noreturn;
 void printf(const char *fmt, ...)
@@ -104,6 +104,9 @@ interface_init(void)
     // Running at new code address - do code relocation fixups
     malloc_init();
 
+    // Start buffering debug output
+    debug_ring_setup();
+
     // Setup romfile items.
     qemu_cfg_init();
     coreboot_cbfs_init();
@@ -166,7 +169,11 @@ prepareboot(void)
     // Run BCVs
     bcv_prepboot();
 
+    // Save the usb descriptor cache
+    usb_prepboot();
+
     // Finalize data structures before boot
+    ramdisk_prepboot();
     cdrom_prepboot();
     pmm_prepboot();
     malloc_prepboot();
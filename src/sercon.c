@@ -7,6 +7,7 @@
 #include "biosvar.h" // SET_BDA
 #include "bregs.h" // struct bregs
 #include "stacks.h" // yield
+#include "malloc.h" // malloc_low
 #include "output.h" // dprintf
 #include "util.h" // irqtimer_calc_ticks
 #include "string.h" // memcpy
@@ -67,6 +68,49 @@ VARLOW u8 sercon_row_last;
 VARLOW u8 sercon_char;
 VARLOW u8 sercon_attr = 0x07;
 
+/*
+ * Output to the terminal is collected in a small transmit buffer and
+ * sent in bursts of up to the uart fifo size, so there is only one
+ * line status check per burst instead of one per byte.  The buffer is
+ * flushed when full, on int 10h return and before polling for input.
+ *
+ * sercon_fifo     is the number of bytes to send per line status check.
+ * sercon_txbuf    is the transmit buffer.
+ * sercon_txcount  is the number of bytes in the transmit buffer.
+ * sercon_txpos    is the number of buffered bytes already sent.
+ */
+#define SERCON_FIFO_SIZE 16
+
+VARLOW u8 sercon_fifo;
+VARLOW u8 sercon_txbuf[SERCON_FIFO_SIZE];
+VARLOW u8 sercon_txcount;
+VARLOW u8 sercon_txpos;
+
+/*
+ * While an 80x25 (or smaller) text mode is active, a shadow copy of the
+ * screen is kept and cell writes only update the shadow.  The changed
+ * column range of each row is sent to the terminal on timer ticks and
+ * keyboard polls, so redrawing unchanged cells costs nothing on the
+ * serial line.
+ *
+ * sercon_screen     is the shadow screen (allocated at setup).
+ * sercon_diff       is set while the shadow screen is in use.
+ * sercon_busy       is set while output is generated (blocks nested
+ *                   flushes from the timer irq).
+ */
+#define SERCON_MAX_ROWS 25
+#define SERCON_MAX_COLS 80
+
+struct sercon_screen_s {
+    u8 dirty_lo[SERCON_MAX_ROWS];
+    u8 dirty_hi[SERCON_MAX_ROWS];
+    u16 cells[SERCON_MAX_ROWS * SERCON_MAX_COLS];
+};
+
+VARLOW struct sercon_screen_s *sercon_screen;
+VARLOW u8 sercon_diff;
+VARLOW u8 sercon_busy;
+
 static VAR16 u8 sercon_cmap[8] = { '0', '4', '2', '6', '1', '5', '3', '7' };
 
 static int sercon_splitmode(void)
@@ -74,29 +118,52 @@ static int sercon_splitmode(void)
     return GET_LOW(sercon_split);
 }
 
-static void sercon_putchar(u8 chr)
+static void sercon_tx_flush(void)
 {
     u16 addr = GET_LOW(sercon_port);
     u32 end = irqtimer_calc_ticks(0x0a);
 
-#if 0
-    /* for visual control sequence debugging */
-    if (chr == '\x1b')
-        chr = '*';
-#endif
-
     for (;;) {
-        u8 lsr = inb(addr+SEROFF_LSR);
-        if ((lsr & 0x60) == 0x60) {
-            // Success - can write data
-            outb(chr, addr+SEROFF_DATA);
+        // Reload position each time - yield() may run a nested flush
+        u8 pos = GET_LOW(sercon_txpos), count = GET_LOW(sercon_txcount);
+        if (pos >= count)
             break;
+        u8 lsr = inb(addr+SEROFF_LSR);
+        if (lsr & 0x20) {
+            // Success - transmit fifo empty, can write a burst of data
+            u8 burst = count - pos;
+            if (burst > GET_LOW(sercon_fifo))
+                burst = GET_LOW(sercon_fifo);
+            SET_LOW(sercon_txpos, pos + burst);
+            while (burst--)
+                outb(GET_LOW(sercon_txbuf[pos++]), addr+SEROFF_DATA);
+            end = irqtimer_calc_ticks(0x0a);
+            continue;
         }
         if (irqtimer_check(end)) {
             break;
         }
         yield();
     }
+    SET_LOW(sercon_txcount, 0);
+    SET_LOW(sercon_txpos, 0);
+}
+
+static void sercon_putchar(u8 chr)
+{
+#if 0
+    /* for visual control sequence debugging */
+    if (chr == '\x1b')
+        chr = '*';
+#endif
+
+    u8 count = GET_LOW(sercon_txcount);
+    if (count >= ARRAY_SIZE(sercon_txbuf)) {
+        sercon_tx_flush();
+        count = 0;
+    }
+    SET_LOW(sercon_txbuf[count], chr);
+    SET_LOW(sercon_txcount, count + 1);
 }
 
 static void sercon_term_reset(void)
@@ -305,6 +372,198 @@ static void sercon_lazy_putchar(u8 chr, u8 attr, u8 teletype)
         SET_LOW(sercon_attr, attr);
 }
 
+/****************************************************************
+ * screen diff output
+ ****************************************************************/
+
+static int sercon_diff_active(void)
+{
+    if (!GET_LOW(sercon_diff))
+        return 0;
+    if (video_rows() > SERCON_MAX_ROWS || video_cols() > SERCON_MAX_COLS) {
+        // Screen doesn't fit the shadow anymore - use lazy output
+        SET_LOW(sercon_diff, 0);
+        return 0;
+    }
+    return 1;
+}
+
+static u16 sercon_diff_get(u8 row, u8 col)
+{
+    struct sercon_screen_s *scr = GET_LOW(sercon_screen);
+    return GET_LOWFLAT(scr->cells[row * SERCON_MAX_COLS + col]);
+}
+
+static void sercon_diff_set(u8 row, u8 col, u16 cell)
+{
+    struct sercon_screen_s *scr = GET_LOW(sercon_screen);
+    u16 *cell_fl = &scr->cells[row * SERCON_MAX_COLS + col];
+    if (GET_LOWFLAT(*cell_fl) == cell)
+        return;
+    SET_LOWFLAT(*cell_fl, cell);
+    if (col < GET_LOWFLAT(scr->dirty_lo[row]))
+        SET_LOWFLAT(scr->dirty_lo[row], col);
+    if (col > GET_LOWFLAT(scr->dirty_hi[row]))
+        SET_LOWFLAT(scr->dirty_hi[row], col);
+}
+
+// Set all shadow cells without marking them dirty.
+static void sercon_diff_reset(u16 cell)
+{
+    struct sercon_screen_s *scr = GET_LOW(sercon_screen);
+    int i;
+    for (i = 0; i < ARRAY_SIZE(scr->cells); i++)
+        SET_LOWFLAT(scr->cells[i], cell);
+    for (i = 0; i < SERCON_MAX_ROWS; i++) {
+        SET_LOWFLAT(scr->dirty_lo[i], 0xff);
+        SET_LOWFLAT(scr->dirty_hi[i], 0);
+    }
+}
+
+// Send the dirty parts of the shadow screen to the terminal.
+static void sercon_diff_flush(void)
+{
+    struct sercon_screen_s *scr = GET_LOW(sercon_screen);
+    u8 row, rows = video_rows();
+    for (row = 0; row < rows; row++) {
+        u8 col = GET_LOWFLAT(scr->dirty_lo[row]);
+        u8 hi = GET_LOWFLAT(scr->dirty_hi[row]);
+        if (col > hi)
+            continue;
+        SET_LOWFLAT(scr->dirty_lo[row], 0xff);
+        SET_LOWFLAT(scr->dirty_hi[row], 0);
+        if (GET_LOW(sercon_row_last) != row ||
+            GET_LOW(sercon_col_last) != col) {
+            sercon_term_cursor_goto(row, col);
+            SET_LOW(sercon_row_last, row);
+        }
+        for (; col <= hi; col++) {
+            u16 cell = sercon_diff_get(row, col);
+            sercon_set_attr(cell >> 8);
+            sercon_print_utf8(cell);
+        }
+        // Terminal cursor stays on the last column (no linewrap), so
+        // a past-the-end column forces a cursor goto on next use.
+        SET_LOW(sercon_col_last, col);
+    }
+}
+
+static void sercon_diff_clear(u8 attr)
+{
+    sercon_set_attr(attr);
+    sercon_term_clear_screen();
+    sercon_diff_reset((attr << 8) | ' ');
+}
+
+// Scroll the given window up by 'lines' (clear it if 'lines' is zero).
+static void sercon_diff_scroll(u8 top, u8 left, u8 bottom, u8 right
+                               , u8 lines, u8 attr)
+{
+    u8 rows = video_rows(), cols = video_cols();
+    if (bottom >= rows)
+        bottom = rows - 1;
+    if (right >= cols)
+        right = cols - 1;
+    if (top > bottom || left > right)
+        return;
+    u8 height = bottom - top + 1;
+    if (!lines || lines > height)
+        lines = height;
+    u16 blank = (attr << 8) | ' ';
+    u8 row, col;
+
+    if (top == 0 && left == 0 && bottom == rows - 1 && right == cols - 1) {
+        if (lines == height) {
+            sercon_diff_clear(attr);
+            return;
+        }
+        // Full screen scroll - let the terminal scroll too
+        sercon_diff_flush();
+        sercon_set_attr(0x07);
+        if (GET_LOW(sercon_row_last) != rows - 1 ||
+            GET_LOW(sercon_col_last) != 0)
+            sercon_term_cursor_goto(rows - 1, 0);
+        for (row = 0; row < lines; row++)
+            sercon_putchar('\n');
+        SET_LOW(sercon_row_last, rows - 1);
+        SET_LOW(sercon_col_last, 0);
+
+        struct sercon_screen_s *scr = GET_LOW(sercon_screen);
+        for (row = 0; row < rows; row++) {
+            u16 *cells = &scr->cells[row * SERCON_MAX_COLS];
+            for (col = 0; col < cols; col++) {
+                u16 cell = 0x0720;
+                if (row + lines < rows)
+                    cell = GET_LOWFLAT(cells[lines * SERCON_MAX_COLS + col]);
+                SET_LOWFLAT(cells[col], cell);
+            }
+        }
+        if (blank != 0x0720)
+            for (row = rows - lines; row < rows; row++)
+                for (col = 0; col < cols; col++)
+                    sercon_diff_set(row, col, blank);
+        return;
+    }
+
+    // Partial window - update the shadow and redraw changed cells
+    for (row = top; row <= bottom; row++)
+        for (col = left; col <= right; col++)
+            sercon_diff_set(row, col, row + lines <= bottom
+                            ? sercon_diff_get(row + lines, col) : blank);
+}
+
+static void sercon_diff_write(u8 chr, u8 attr, u16 count)
+{
+    u8 rows = video_rows(), cols = video_cols();
+    u8 row = cursor_pos_row(), col = cursor_pos_col();
+    if (chr == ' ' && count == rows * cols && !row && !col) {
+        // override everything with spaces -> this is clear screen
+        sercon_diff_clear(attr);
+        return;
+    }
+    while (count-- && row < rows) {
+        sercon_diff_set(row, col, (attr << 8) | chr);
+        if (++col >= cols) {
+            col = 0;
+            row++;
+        }
+    }
+}
+
+static void sercon_diff_teletype(u8 chr)
+{
+    u8 row = cursor_pos_row(), col = cursor_pos_col();
+    switch (chr) {
+    case 7:
+        sercon_putchar(0x07);
+        return;
+    case 8:
+        if (col > 0)
+            col--;
+        break;
+    case '\r':
+        col = 0;
+        break;
+    case '\n':
+        row++;
+        break;
+    default:
+        if (row < video_rows() && col < video_cols())
+            sercon_diff_set(row, col, (sercon_diff_get(row, col) & 0xff00)
+                            | chr);
+        if (++col >= video_cols()) {
+            col = 0;
+            row++;
+        }
+        break;
+    }
+    if (row >= video_rows()) {
+        row = video_rows() - 1;
+        sercon_diff_scroll(0, 0, row, video_cols() - 1, 1, 0x07);
+    }
+    sercon_cursor_pos_set(row, col);
+}
+
 /* Set video mode */
 static void sercon_1000(struct bregs *regs)
 {
@@ -342,6 +601,9 @@ static void sercon_1000(struct bregs *regs)
     }
 
     SET_LOW(sercon_enable, mode <= 0x07);
+    SET_LOW(sercon_diff, GET_LOW(sercon_screen) && mode <= 0x07);
+    if (GET_LOW(sercon_diff))
+        sercon_diff_reset(0x0720);
     SET_LOW(sercon_col_last, 0);
     SET_LOW(sercon_row_last, 0);
     SET_LOW(sercon_attr_last, 0);
@@ -376,6 +638,11 @@ static void sercon_1003(struct bregs *regs)
 /* Scroll up window */
 static void sercon_1006(struct bregs *regs)
 {
+    if (sercon_diff_active()) {
+        sercon_diff_scroll(regs->ch, regs->cl, regs->dh, regs->dl
+                           , regs->al, regs->bh);
+        return;
+    }
     sercon_lazy_flush();
     if (regs->al == 0) {
         /* clear rect, do only in case this looks like a fullscreen clear */
@@ -395,6 +662,13 @@ static void sercon_1006(struct bregs *regs)
 /* Read character and attribute at cursor position */
 static void sercon_1008(struct bregs *regs)
 {
+    if (sercon_diff_active() && cursor_pos_row() < video_rows()
+        && cursor_pos_col() < video_cols()) {
+        u16 cell = sercon_diff_get(cursor_pos_row(), cursor_pos_col());
+        regs->ah = cell >> 8;
+        regs->al = cell;
+        return;
+    }
     regs->ah = 0x07;
     regs->bh = ' ';
 }
@@ -404,6 +678,11 @@ static void sercon_1009(struct bregs *regs)
 {
     u16 count = regs->cx;
 
+    if (sercon_diff_active()) {
+        sercon_diff_write(regs->al, regs->bl, count);
+        return;
+    }
+
     if (count == 1) {
         sercon_lazy_putchar(regs->al, regs->bl, 0);
 
@@ -431,6 +710,11 @@ static void sercon_1009(struct bregs *regs)
 /* Teletype output */
 static void sercon_100e(struct bregs *regs)
 {
+    if (sercon_diff_active()) {
+        sercon_diff_teletype(regs->al);
+        return;
+    }
+
     switch (regs->al) {
     case 7:
         sercon_putchar(0x07);
@@ -493,6 +777,7 @@ handle_sercon(struct bregs *regs)
             return;
     }
 
+    SET_LOW(sercon_busy, 1);
     switch (regs->ah) {
     case 0x00: sercon_1000(regs); break;
     case 0x01: sercon_1001(regs); break;
@@ -506,6 +791,15 @@ handle_sercon(struct bregs *regs)
     case 0x4f: sercon_104f(regs); break;
     default:   sercon_10XX(regs); break;
     }
+    // The shadow screen is normally sent from the timer irq, which won't
+    // run if the caller has interrupts off - so send it right away then,
+    // and at the end of every teletype line.
+    if (sercon_diff_active()
+        && (!(regs->flags & F_IF)
+            || (regs->ah == 0x0e && (regs->al == '\n' || regs->al == '\r'))))
+        sercon_diff_flush();
+    sercon_tx_flush();
+    SET_LOW(sercon_busy, 0);
 }
 
 void sercon_setup(void)
@@ -538,10 +832,20 @@ void sercon_setup(void)
         sercon_real_vga_handler = seabios;
     }
 
+    struct sercon_screen_s *scr = malloc_low(sizeof(*scr));
+    if (scr)
+        SET_LOW(sercon_screen, scr);
+    else
+        warn_noalloc();
+
     SET_IVT(0x10, FUNC16(entry_sercon));
     SET_LOW(sercon_port, addr);
     outb(0x03, addr + SEROFF_LCR); // 8N1
     outb(0x01, addr + 0x02);       // enable fifo
+    if ((inb(addr + SEROFF_IIR) & 0xc0) == 0xc0)
+        SET_LOW(sercon_fifo, SERCON_FIFO_SIZE);
+    else
+        SET_LOW(sercon_fifo, 1);
 }
 
 /****************************************************************
@@ -634,8 +938,15 @@ sercon_check_event(void)
     if (inb(addr + SEROFF_LSR) == 0xFF)
         return;
 
-    // flush pending output
-    sercon_lazy_flush();
+    // flush pending output (unless called while output is generated)
+    if (!GET_LOW(sercon_busy)) {
+        SET_LOW(sercon_busy, 1);
+        if (sercon_diff_active())
+            sercon_diff_flush();
+        sercon_lazy_flush();
+        sercon_tx_flush();
+        SET_LOW(sercon_busy, 0);
+    }
 
     // read all available data
     while (inb(addr + SEROFF_LSR) & 0x01) {
@@ -3,9 +3,53 @@
 
 #include "types.h" // u32
 
+// Hash state for incremental hashing via the *_init(), *_update() and
+// *_final() functions.
+struct sha1_ctx {
+    u32 h[5];
+    int ni; // using the x86 SHA extensions (see sha_ni_get())
+    u64 length;
+    u8 buf[64];
+};
+
+struct sha256_ctx {
+    u32 h[8];
+    int ni;
+    u64 length;
+    u8 buf[64];
+};
+
+struct sha512_ctx {
+    u64 h[8];
+    u64 length;
+    u8 buf[128];
+};
+
+// sha1.c
+void sha1_init(struct sha1_ctx *ctx);
+void sha1_update(struct sha1_ctx *ctx, const u8 *data, u32 length);
+void sha1_final(struct sha1_ctx *ctx, u8 *hash);
 void sha1(const u8 *data, u32 length, u8 *hash);
+
+// sha256.c
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const u8 *data, u32 length);
+void sha256_final(struct sha256_ctx *ctx, u8 *hash);
 void sha256(const u8 *data, u32 length, u8 *hash);
+
+// sha512.c
+void sha384_init(struct sha512_ctx *ctx);
+void sha384_final(struct sha512_ctx *ctx, u8 *hash);
 void sha384(const u8 *data, u32 length, u8 *hash);
+void sha512_init(struct sha512_ctx *ctx);
+void sha512_update(struct sha512_ctx *ctx, const u8 *data, u32 length);
+void sha512_final(struct sha512_ctx *ctx, u8 *hash);
 void sha512(const u8 *data, u32 length, u8 *hash);
 
+// sha_ni.c
+int sha_ni_get(void);
+void sha_ni_put(void);
+void sha1_ni_blocks(u32 *h, const u8 *data, u32 count);
+void sha256_ni_blocks(u32 *h, const u8 *data, u32 count);
+
 #endif // sha.h
@@ -12,18 +12,13 @@
 //
 
 #include "config.h"
-#include "byteorder.h" // cpu_to_*, __swab64
+#include "byteorder.h" // cpu_to_*
 #include "sha.h" // sha1
 #include "string.h" // memcpy
 #include "x86.h" // rol
 
-typedef struct _sha1_ctx {
-    u32 h[5];
-} sha1_ctx;
-
-
 static void
-sha1_block(u32 *w, sha1_ctx *ctx)
+sha1_block(u32 *w, struct sha1_ctx *ctx)
 {
     u32 i;
     u32 a,b,c,d,e,f;
@@ -83,65 +78,95 @@ sha1_block(u32 *w, sha1_ctx *ctx)
 }
 
 
+// Process 'count' 64-byte blocks of 'data'.
 static void
-sha1_do(sha1_ctx *ctx, const u8 *data32, u32 length)
+sha1_blocks(struct sha1_ctx *ctx, const u8 *data, u32 count)
 {
-    u32 offset;
-    u16 num;
-    u32 bits = 0;
+    if (ctx->ni) {
+        sha1_ni_blocks(ctx->h, data, count);
+        return;
+    }
+
     u32 w[80];
-    u64 tmp;
+    for (; count; count--, data += 64) {
+        memcpy(w, data, 64);
+        sha1_block(w, ctx);
+    }
+}
 
-    /* treat data in 64-byte chunks */
-    for (offset = 0; length - offset >= 64; offset += 64) {
-        memcpy(w, data32 + offset, 64);
-        sha1_block((u32 *)w, ctx);
-        bits += (64 * 8);
+
+void
+sha1_init(struct sha1_ctx *ctx)
+{
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xefcdab89;
+    ctx->h[2] = 0x98badcfe;
+    ctx->h[3] = 0x10325476;
+    ctx->h[4] = 0xc3d2e1f0;
+    ctx->ni = sha_ni_get();
+    ctx->length = 0;
+}
+
+void
+sha1_update(struct sha1_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->length % 64;
+    ctx->length += length;
+
+    /* complete a partially filled block */
+    if (used) {
+        u32 num = 64 - used;
+        if (num > length)
+            num = length;
+        memcpy(&ctx->buf[used], data, num);
+        data += num;
+        length -= num;
+        if (used + num < 64)
+            return;
+        sha1_blocks(ctx, ctx->buf, 1);
     }
 
-    /* last block with less than 64 bytes */
-    num = length - offset;
-    bits += (num << 3);
+    /* treat data in 64-byte chunks */
+    sha1_blocks(ctx, data, length / 64);
+    memcpy(ctx->buf, data + (length & ~63), length % 64);
+}
 
-    memcpy(w, data32 + offset, num);
-    ((u8 *)w)[num] = 0x80;
-    if (64 - (num + 1) > 0)
-        memset( &((u8 *)w)[num + 1], 0x0, 64 - (num + 1));
+void
+sha1_final(struct sha1_ctx *ctx, u8 *hash)
+{
+    u32 num = ctx->length % 64;
+
+    ctx->buf[num++] = 0x80;
+    memset(&ctx->buf[num], 0x0, 64 - num);
 
-    if (num >= 56) {
+    if (num > 56) {
         /* cannot append number of bits here */
-        sha1_block((u32 *)w, ctx);
-        memset(w, 0x0, 60);
+        sha1_blocks(ctx, ctx->buf, 1);
+        memset(ctx->buf, 0x0, 56);
     }
 
     /* write number of bits to end of block */
-    tmp = __swab64(bits);
-    memcpy(&w[14], &tmp, 8);
+    u64 bits = cpu_to_be64(ctx->length << 3);
+    memcpy(&ctx->buf[56], &bits, 8);
 
-    sha1_block(w, ctx);
+    sha1_blocks(ctx, ctx->buf, 1);
+    if (ctx->ni)
+        sha_ni_put();
 
     /* need to switch result's endianness */
     for (num = 0; num < 5; num++)
         ctx->h[num] = cpu_to_be32(ctx->h[num]);
+    memcpy(hash, ctx->h, 20);
 }
 
-
 void
 sha1(const u8 *data, u32 length, u8 *hash)
 {
     if (!CONFIG_TCGBIOS)
         return;
 
-    sha1_ctx ctx = {
-        .h[0] = 0x67452301,
-        .h[1] = 0xefcdab89,
-        .h[2] = 0x98badcfe,
-        .h[3] = 0x10325476,
-        .h[4] = 0xc3d2e1f0,
-    };
-
-    sha1_do(&ctx, data, length);
-    memcpy(hash, &ctx.h[0], 20);
-
-    return;
+    struct sha1_ctx ctx;
+    sha1_init(&ctx);
+    sha1_update(&ctx, data, length);
+    sha1_final(&ctx, hash);
 }
@@ -20,10 +20,6 @@
 #include "string.h"
 #include "x86.h"
 
-typedef struct _sha256_ctx {
-    u32 h[8];
-} sha256_ctx;
-
 static inline u32 Ch(u32 x, u32 y, u32 z)
 {
     return (x & y) | ((x ^ 0xffffffff) & z);
@@ -54,7 +50,7 @@ static inline u32 sigma1(u32 x)
     return ror(x, 17) ^ ror(x, 19) ^ (x >> 10);
 }
 
-static void sha256_block(u32 *w, sha256_ctx *ctx)
+static void sha256_block(u32 *w, struct sha256_ctx *ctx)
 {
     u32 t;
     u32 a, b, c, d, e, f, g, h;
@@ -143,69 +139,105 @@ static void sha256_block(u32 *w, sha256_ctx *ctx)
     ctx->h[7] += h;
 }
 
-static void sha256_do(sha256_ctx *ctx, const u8 *data32, u32 length)
+/* Process 'count' 64-byte blocks of 'data' */
+static void sha256_blocks(struct sha256_ctx *ctx, const u8 *data, u32 count)
 {
-    u32 offset;
-    u16 num;
-    u32 bits = 0;
     u32 w[64];
-    u64 tmp;
 
-    /* treat data in 64-byte chunks */
-    for (offset = 0; length - offset >= 64; offset += 64) {
-        memcpy(w, data32 + offset, 64);
-        sha256_block((u32 *)w, ctx);
-        bits += (64 * 8);
+    if (ctx->ni) {
+        sha256_ni_blocks(ctx->h, data, count);
+        return;
+    }
+
+    for (; count; count--, data += 64) {
+        memcpy(w, data, 64);
+        sha256_block(w, ctx);
+    }
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+    /*
+     * FIPS 180-4: 6.2.1
+     *   -> 5.3.3: initial hash value
+     */
+    static const u32 sha256_h0[8] = {
+        0x6a09e667,
+        0xbb67ae85,
+        0x3c6ef372,
+        0xa54ff53a,
+        0x510e527f,
+        0x9b05688c,
+        0x1f83d9ab,
+        0x5be0cd19
+    };
+
+    memcpy(ctx->h, sha256_h0, sizeof(ctx->h));
+    ctx->ni = sha_ni_get();
+    ctx->length = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->length % 64;
+    u32 num;
+
+    ctx->length += length;
+
+    /* complete a partially filled block */
+    if (used) {
+        num = 64 - used;
+        if (num > length)
+            num = length;
+        memcpy(&ctx->buf[used], data, num);
+        data += num;
+        length -= num;
+        if (used + num < 64)
+            return;
+        sha256_blocks(ctx, ctx->buf, 1);
     }
 
-    /* last block with less than 64 bytes */
-    num = length - offset;
-    bits += (num << 3);
+    /* treat data in 64-byte chunks */
+    sha256_blocks(ctx, data, length / 64);
+    memcpy(ctx->buf, data + (length & ~63), length % 64);
+}
+
+void sha256_final(struct sha256_ctx *ctx, u8 *hash)
+{
+    u32 num = ctx->length % 64;
+    u64 bits;
 
-    memcpy(w, data32 + offset, num);
     /*
      * FIPS 180-4 5.1: Padding the Message
      */
-    ((u8 *)w)[num] = 0x80;
-    if (64 - (num + 1) > 0)
-        memset( &((u8 *)w)[num + 1], 0, 64 - (num + 1));
+    ctx->buf[num++] = 0x80;
+    memset(&ctx->buf[num], 0, 64 - num);
 
-    if (num >= 56) {
+    if (num > 56) {
         /* cannot append number of bits here */
-        sha256_block((u32 *)w, ctx);
-        memset(w, 0, 60);
+        sha256_blocks(ctx, ctx->buf, 1);
+        memset(ctx->buf, 0, 56);
     }
 
     /* write number of bits to end of block */
-    tmp = cpu_to_be64(bits);
-    memcpy(&w[14], &tmp, 8);
+    bits = cpu_to_be64(ctx->length << 3);
+    memcpy(&ctx->buf[56], &bits, 8);
 
-    sha256_block(w, ctx);
+    sha256_blocks(ctx, ctx->buf, 1);
+    if (ctx->ni)
+        sha_ni_put();
 
     /* need to switch result's endianness */
     for (num = 0; num < 8; num++)
         ctx->h[num] = cpu_to_be32(ctx->h[num]);
+    memcpy(hash, ctx->h, sizeof(ctx->h));
 }
 
 void sha256(const u8 *data, u32 length, u8 *hash)
 {
-    sha256_ctx ctx = {
-        .h = {
-            /*
-             * FIPS 180-4: 6.2.1
-             *   -> 5.3.3: initial hash value
-             */
-            0x6a09e667,
-            0xbb67ae85,
-            0x3c6ef372,
-            0xa54ff53a,
-            0x510e527f,
-            0x9b05688c,
-            0x1f83d9ab,
-            0x5be0cd19
-        }
-    };
+    struct sha256_ctx ctx;
 
-    sha256_do(&ctx, data, length);
-    memcpy(hash, ctx.h, sizeof(ctx.h));
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, length);
+    sha256_final(&ctx, hash);
 }
@@ -19,10 +19,6 @@
 #include "sha.h"
 #include "string.h"
 
-typedef struct _sha512_ctx {
-    u64 h[8];
-} sha512_ctx;
-
 static inline u64 ror64(u64 x, u8 n)
 {
     return (x >> n) | (x << (64 - n));
@@ -58,7 +54,7 @@ static inline u64 sigma1_64(u64 x)
     return ror64(x, 19) ^ ror64(x, 61) ^ (x >> 6);
 }
 
-static void sha512_block(u64 *w, sha512_ctx *ctx)
+static void sha512_block(u64 *w, struct sha512_ctx *ctx)
 {
     u32 t;
     u64 a, b, c, d, e, f, g, h;
@@ -97,15 +93,15 @@ static void sha512_block(u64 *w, sha512_ctx *ctx)
      *    W(t) = M(t)
      * 16 <= i <= 79:
      *    W(t) = sigma1(W(t-2)) + W(t-7) + sigma0(W(t-15)) + W(t-16)
+     *
+     * Only the last 16 W(t) are needed, so they are calculated in step 3
+     * in a 16 entry ring to keep the stack usage low.
      */
 
     /* w(0)..w(15) are in big endian format */
     for (t = 0; t <= 15; t++)
         w[t] = be64_to_cpu(w[t]);
 
-    for (t = 16; t <= 79; t++)
-        w[t] = sigma1_64(w[t-2]) + w[t-7] + sigma0_64(w[t-15]) + w[t-16];
-
     /*
      * step 2: a = H0, b = H1, c = H2, d = H3, e = H4, f = H5, g = H6, h = H7
      */
@@ -125,7 +121,10 @@ static void sha512_block(u64 *w, sha512_ctx *ctx)
      *    h = g; g = f; f = e; e = d + T1; d = c; c = b; b = a; a + T1 + T2
      */
     for (t = 0; t <= 79; t++) {
-        T1 = h + sum1_64(e) + Ch64(e, f, g) + sha_ko[t] + w[t];
+        if (t >= 16)
+            w[t & 15] += (sigma1_64(w[(t - 2) & 15]) + w[(t - 7) & 15]
+                          + sigma0_64(w[(t - 15) & 15]));
+        T1 = h + sum1_64(e) + Ch64(e, f, g) + sha_ko[t] + w[t & 15];
         T2 = sum0_64(a) + Maj64(a, b, c);
         h = g;
         g = f;
@@ -151,94 +150,141 @@ static void sha512_block(u64 *w, sha512_ctx *ctx)
     ctx->h[7] += h;
 }
 
-static void sha512_do(sha512_ctx *ctx, const u8 *data32, u32 length)
+/* Process 'count' 128-byte blocks of 'data' */
+static void sha512_blocks(struct sha512_ctx *ctx, const u8 *data, u32 count)
 {
-    u32 offset;
-    u16 num;
-    u64 bits = 0;
-    u64 w[80];
-    u64 tmp;
+    u64 w[16];
 
-    /* treat data in 128-byte/1024 bit chunks */
-    for (offset = 0; length - offset >= 128; offset += 128) {
-        memcpy(w, data32 + offset, 128);
+    for (; count; count--, data += 128) {
+        memcpy(w, data, 128);
         sha512_block(w, ctx);
-        bits += (128 * 8);
     }
+}
+
+void sha384_init(struct sha512_ctx *ctx)
+{
+    /*
+     * FIPS 180-4: 6.2.1
+     *   -> 5.3.4: initial hash value
+     */
+    static const u64 sha384_h0[8] = {
+        0xcbbb9d5dc1059ed8,
+        0x629a292a367cd507,
+        0x9159015a3070dd17,
+        0x152fecd8f70e5939,
+        0x67332667ffc00b31,
+        0x8eb44a8768581511,
+        0xdb0c2e0d64f98fa7,
+        0x47b5481dbefa4fa4
+    };
+
+    memcpy(ctx->h, sha384_h0, sizeof(ctx->h));
+    ctx->length = 0;
+}
+
+void sha512_init(struct sha512_ctx *ctx)
+{
+    /*
+     * FIPS 180-4: 6.2.1
+     *   -> 5.3.5: initial hash value
+     */
+    static const u64 sha512_h0[8] = {
+        0x6a09e667f3bcc908,
+        0xbb67ae8584caa73b,
+        0x3c6ef372fe94f82b,
+        0xa54ff53a5f1d36f1,
+        0x510e527fade682d1,
+        0x9b05688c2b3e6c1f,
+        0x1f83d9abfb41bd6b,
+        0x5be0cd19137e2179
+    };
+
+    memcpy(ctx->h, sha512_h0, sizeof(ctx->h));
+    ctx->length = 0;
+}
+
+/* SHA-384 uses the same update function as SHA-512 */
+void sha512_update(struct sha512_ctx *ctx, const u8 *data, u32 length)
+{
+    u32 used = ctx->length % 128;
+    u32 num;
+
+    ctx->length += length;
+
+    /* complete a partially filled block */
+    if (used) {
+        num = 128 - used;
+        if (num > length)
+            num = length;
+        memcpy(&ctx->buf[used], data, num);
+        data += num;
+        length -= num;
+        if (used + num < 128)
+            return;
+        sha512_blocks(ctx, ctx->buf, 1);
+    }
+
+    /* treat data in 128-byte/1024 bit chunks */
+    sha512_blocks(ctx, data, length / 128);
+    memcpy(ctx->buf, data + (length & ~127), length % 128);
+}
 
-    /* last block with less than 128 bytes */
-    num = length - offset;
-    bits += (num << 3);
+static void sha512_pad(struct sha512_ctx *ctx)
+{
+    u32 num = ctx->length % 128;
+    u64 bits;
 
-    memcpy(w, data32 + offset, num);
     /*
      * FIPS 180-4 5.1: Padding the Message
      */
-    ((u8 *)w)[num] = 0x80;
-    if (128 - (num + 1) > 0)
-        memset( &((u8 *)w)[num + 1], 0, 128 - (num + 1));
+    ctx->buf[num++] = 0x80;
+    memset(&ctx->buf[num], 0, 128 - num);
 
-    if (num >= 112) {
+    if (num > 112) {
         /* cannot append number of bits here;
          * need space for 128 bits (16 bytes)
          */
-        sha512_block((u64 *)w, ctx);
-        memset(w, 0, 128);
+        sha512_blocks(ctx, ctx->buf, 1);
+        memset(ctx->buf, 0, 120);
     }
 
     /* write number of bits to end of the block; we write 64 bits */
-    tmp = cpu_to_be64(bits);
-    memcpy(&w[15], &tmp, 8);
+    bits = cpu_to_be64(ctx->length << 3);
+    memcpy(&ctx->buf[120], &bits, 8);
 
-    sha512_block(w, ctx);
+    sha512_blocks(ctx, ctx->buf, 1);
 
     /* need to switch result's endianness */
     for (num = 0; num < 8; num++)
         ctx->h[num] = cpu_to_be64(ctx->h[num]);
 }
 
+void sha384_final(struct sha512_ctx *ctx, u8 *hash)
+{
+    sha512_pad(ctx);
+    memcpy(hash, ctx->h, 384/8);
+}
+
+void sha512_final(struct sha512_ctx *ctx, u8 *hash)
+{
+    sha512_pad(ctx);
+    memcpy(hash, ctx->h, sizeof(ctx->h));
+}
+
 void sha384(const u8 *data, u32 length, u8 *hash)
 {
-    sha512_ctx ctx = {
-        .h = {
-            /*
-             * FIPS 180-4: 6.2.1
-             *   -> 5.3.4: initial hash value
-             */
-            0xcbbb9d5dc1059ed8,
-            0x629a292a367cd507,
-            0x9159015a3070dd17,
-            0x152fecd8f70e5939,
-            0x67332667ffc00b31,
-            0x8eb44a8768581511,
-            0xdb0c2e0d64f98fa7,
-            0x47b5481dbefa4fa4
-        }
-    };
+    struct sha512_ctx ctx;
 
-    sha512_do(&ctx, data, length);
-    memcpy(hash, ctx.h, 384/8);
+    sha384_init(&ctx);
+    sha512_update(&ctx, data, length);
+    sha384_final(&ctx, hash);
 }
 
 void sha512(const u8 *data, u32 length, u8 *hash)
 {
-    sha512_ctx ctx = {
-        .h = {
-            /*
-             * FIPS 180-4: 6.2.1
-             *   -> 5.3.5: initial hash value
-             */
-            0x6a09e667f3bcc908,
-            0xbb67ae8584caa73b,
-            0x3c6ef372fe94f82b,
-            0xa54ff53a5f1d36f1,
-            0x510e527fade682d1,
-            0x9b05688c2b3e6c1f,
-            0x1f83d9abfb41bd6b,
-            0x5be0cd19137e2179
-        }
-    };
+    struct sha512_ctx ctx;
 
-    sha512_do(&ctx, data, length);
-    memcpy(hash, ctx.h, sizeof(ctx.h));
+    sha512_init(&ctx);
+    sha512_update(&ctx, data, length);
+    sha512_final(&ctx, hash);
 }
@@ -0,0 +1,277 @@
+// SHA1 and SHA256 block processing using the x86 SHA extensions
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+//
+//  See: Intel(R) SHA Extensions - New Instructions Supporting the Secure
+//       Hash Algorithm on Intel(R) Architecture Processors (July 2013)
+//
+
+#include "config.h" // CONFIG_TCGBIOS
+#include "sha.h" // sha1_ni_blocks
+#include "x86.h" // cpuid, sse_enter
+
+#define CPUID_1_ECX_SSSE3 (1 << 9)
+#define CPUID_7_EBX_SHA   (1 << 29)
+
+typedef int v4si __attribute__((vector_size(16)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+
+#define SHA_NI_TARGET __attribute__((target("ssse3,sha")))
+
+
+/****************************************************************
+ * SSE enabling
+ ****************************************************************/
+
+// Cached cpu support check: 0 = not checked yet, 1 = present, 2 = absent
+u8 ShaNiPresent VARLOW;
+// Number of hashes currently using the extensions, and the cr4 value to
+// restore when the last one is done.
+u8 ShaNiUsers VARLOW;
+u32 ShaNiCr4 VARLOW;
+
+// Check for SHA extension support.
+static int
+sha_ni_present(void)
+{
+    if (ShaNiPresent)
+        return ShaNiPresent == 1;
+    ShaNiPresent = 2;
+    u32 eax, ebx, ecx, edx;
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+        return 0;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & CPUID_1_ECX_SSSE3))
+        return 0;
+    __cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ebx & CPUID_7_EBX_SHA))
+        return 0;
+    ShaNiPresent = 1;
+    return 1;
+}
+
+// Start using the SHA extensions for a hash, enabling the SSE
+// instructions if no other hash has done so.  Returns zero if the
+// extensions can't be used; otherwise sha_ni_put() must be called when
+// the hash is complete.
+int
+sha_ni_get(void)
+{
+    if (!CONFIG_TCGBIOS || !sha_ni_present())
+        return 0;
+    if (!ShaNiUsers) {
+        u32 cr4 = sse_enter();
+        if (!cr4)
+            return 0;
+        ShaNiCr4 = cr4;
+    }
+    ShaNiUsers++;
+    return 1;
+}
+
+// A hash no longer uses the SHA extensions.
+void
+sha_ni_put(void)
+{
+    if (!--ShaNiUsers)
+        sse_leave(ShaNiCr4);
+}
+
+
+/****************************************************************
+ * SHA1
+ ****************************************************************/
+
+static inline SHA_NI_TARGET v4si
+sha1_ni_load(const u8 *data)
+{
+    const v16qi bswap = { 15, 14, 13, 12, 11, 10, 9, 8
+                          , 7, 6, 5, 4, 3, 2, 1, 0 };
+    v16qi msg = __builtin_ia32_loaddqu((const char *)data);
+    return (v4si)__builtin_ia32_pshufb128(msg, bswap);
+}
+
+// Calculate W[t..t+3] from the previous 16 message words.
+#define SHA1_MSG(m0, m1, m2, m3)                                        \
+    __builtin_ia32_sha1msg2(__builtin_ia32_sha1msg1(m0, m1) ^ m2, m3)
+
+// Run four rounds with the given message words.
+#define SHA1_ROUNDS4(func, msg) do {                                    \
+        e = __builtin_ia32_sha1nexte(prev, msg);                        \
+        prev = abcd;                                                    \
+        abcd = __builtin_ia32_sha1rnds4(abcd, e, func);                 \
+    } while (0)
+
+#define SHA1_ROUNDS4_MSG(func, m0, m1, m2, m3) do {                     \
+        m0 = SHA1_MSG(m0, m1, m2, m3);                                  \
+        SHA1_ROUNDS4(func, m0);                                         \
+    } while (0)
+
+static SHA_NI_TARGET void
+sha1_ni_process(u32 *h, const u8 *data, u32 count)
+{
+    v4si abcd = { h[3], h[2], h[1], h[0] };
+    v4si e0 = { 0, 0, 0, h[4] };
+
+    for (; count; count--, data += 64) {
+        v4si abcd_save = abcd, e0_save = e0, prev, e;
+
+        // Rounds 0-15
+        v4si m0 = sha1_ni_load(data);
+        v4si m1 = sha1_ni_load(data + 16);
+        v4si m2 = sha1_ni_load(data + 32);
+        v4si m3 = sha1_ni_load(data + 48);
+        e = e0 + m0;
+        prev = abcd;
+        abcd = __builtin_ia32_sha1rnds4(abcd, e, 0);
+        SHA1_ROUNDS4(0, m1);
+        SHA1_ROUNDS4(0, m2);
+        SHA1_ROUNDS4(0, m3);
+
+        // Rounds 16-79
+        SHA1_ROUNDS4_MSG(0, m0, m1, m2, m3);
+        SHA1_ROUNDS4_MSG(1, m1, m2, m3, m0);
+        SHA1_ROUNDS4_MSG(1, m2, m3, m0, m1);
+        SHA1_ROUNDS4_MSG(1, m3, m0, m1, m2);
+        SHA1_ROUNDS4_MSG(1, m0, m1, m2, m3);
+        SHA1_ROUNDS4_MSG(1, m1, m2, m3, m0);
+        SHA1_ROUNDS4_MSG(2, m2, m3, m0, m1);
+        SHA1_ROUNDS4_MSG(2, m3, m0, m1, m2);
+        SHA1_ROUNDS4_MSG(2, m0, m1, m2, m3);
+        SHA1_ROUNDS4_MSG(2, m1, m2, m3, m0);
+        SHA1_ROUNDS4_MSG(2, m2, m3, m0, m1);
+        SHA1_ROUNDS4_MSG(3, m3, m0, m1, m2);
+        SHA1_ROUNDS4_MSG(3, m0, m1, m2, m3);
+        SHA1_ROUNDS4_MSG(3, m1, m2, m3, m0);
+        SHA1_ROUNDS4_MSG(3, m2, m3, m0, m1);
+        SHA1_ROUNDS4_MSG(3, m3, m0, m1, m2);
+
+        e0 = __builtin_ia32_sha1nexte(prev, e0_save);
+        abcd += abcd_save;
+    }
+
+    h[0] = abcd[3];
+    h[1] = abcd[2];
+    h[2] = abcd[1];
+    h[3] = abcd[0];
+    h[4] = e0[3];
+}
+
+// Process 'count' 64-byte blocks of 'data' into the SHA1 state 'h'.  Only
+// valid between sha_ni_get() and sha_ni_put().
+void
+sha1_ni_blocks(u32 *h, const u8 *data, u32 count)
+{
+    if (count)
+        sha1_ni_process(h, data, count);
+}
+
+
+/****************************************************************
+ * SHA256
+ ****************************************************************/
+
+static const u32 sha256_ni_k[64] __aligned(16) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline SHA_NI_TARGET v4si
+sha256_ni_load(const u8 *data)
+{
+    const v16qi bswap = { 3, 2, 1, 0, 7, 6, 5, 4
+                          , 11, 10, 9, 8, 15, 14, 13, 12 };
+    v16qi msg = __builtin_ia32_loaddqu((const char *)data);
+    return (v4si)__builtin_ia32_pshufb128(msg, bswap);
+}
+
+// Calculate W[t..t+3] from the previous 16 message words.
+#define SHA256_MSG(m0, m1, m2, m3)                                      \
+    __builtin_ia32_sha256msg2(                                          \
+        __builtin_ia32_sha256msg1(m0, m1)                               \
+        + (v4si)__builtin_ia32_palignr128((v2di)m3, (v2di)m2, 32), m3)
+
+// Run four rounds with the given message words.
+#define SHA256_ROUNDS4(i, msg) do {                                     \
+        v4si wk = msg + *(const v4si *)&sha256_ni_k[(i) * 4];           \
+        cdgh = __builtin_ia32_sha256rnds2(cdgh, abef, wk);              \
+        wk = __builtin_ia32_pshufd(wk, 0x0e);                           \
+        abef = __builtin_ia32_sha256rnds2(abef, cdgh, wk);              \
+    } while (0)
+
+#define SHA256_ROUNDS4_MSG(i, m0, m1, m2, m3) do {                      \
+        m0 = SHA256_MSG(m0, m1, m2, m3);                                \
+        SHA256_ROUNDS4(i, m0);                                          \
+    } while (0)
+
+static SHA_NI_TARGET void
+sha256_ni_process(u32 *h, const u8 *data, u32 count)
+{
+    v4si abef = { h[5], h[4], h[1], h[0] };
+    v4si cdgh = { h[7], h[6], h[3], h[2] };
+
+    for (; count; count--, data += 64) {
+        v4si abef_save = abef, cdgh_save = cdgh;
+
+        // Rounds 0-15
+        v4si m0 = sha256_ni_load(data);
+        v4si m1 = sha256_ni_load(data + 16);
+        v4si m2 = sha256_ni_load(data + 32);
+        v4si m3 = sha256_ni_load(data + 48);
+        SHA256_ROUNDS4(0, m0);
+        SHA256_ROUNDS4(1, m1);
+        SHA256_ROUNDS4(2, m2);
+        SHA256_ROUNDS4(3, m3);
+
+        // Rounds 16-63
+        SHA256_ROUNDS4_MSG(4, m0, m1, m2, m3);
+        SHA256_ROUNDS4_MSG(5, m1, m2, m3, m0);
+        SHA256_ROUNDS4_MSG(6, m2, m3, m0, m1);
+        SHA256_ROUNDS4_MSG(7, m3, m0, m1, m2);
+        SHA256_ROUNDS4_MSG(8, m0, m1, m2, m3);
+        SHA256_ROUNDS4_MSG(9, m1, m2, m3, m0);
+        SHA256_ROUNDS4_MSG(10, m2, m3, m0, m1);
+        SHA256_ROUNDS4_MSG(11, m3, m0, m1, m2);
+        SHA256_ROUNDS4_MSG(12, m0, m1, m2, m3);
+        SHA256_ROUNDS4_MSG(13, m1, m2, m3, m0);
+        SHA256_ROUNDS4_MSG(14, m2, m3, m0, m1);
+        SHA256_ROUNDS4_MSG(15, m3, m0, m1, m2);
+
+        abef += abef_save;
+        cdgh += cdgh_save;
+    }
+
+    h[0] = abef[3];
+    h[1] = abef[2];
+    h[2] = cdgh[3];
+    h[3] = cdgh[2];
+    h[4] = abef[1];
+    h[5] = abef[0];
+    h[6] = cdgh[1];
+    h[7] = cdgh[0];
+}
+
+// Process 'count' 64-byte blocks of 'data' into the SHA256 state 'h'.
+// Only valid between sha_ni_get() and sha_ni_put().
+void
+sha256_ni_blocks(u32 *h, const u8 *data, u32 count)
+{
+    if (count)
+        sha256_ni_process(h, data, count);
+}
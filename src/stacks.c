@@ -426,6 +426,7 @@ _farcall16(struct bregs *callregs, u16 callregseg)
 void
 farcall16(struct bregs *callregs)
 {
+    debug_ring_drain();
     call16_override(0);
     _farcall16(callregs, 0);
 }
@@ -434,6 +435,7 @@ farcall16(struct bregs *callregs)
 void
 farcall16big(struct bregs *callregs)
 {
+    debug_ring_drain();
     call16_override(1);
     _farcall16(callregs, 0);
 }
@@ -444,6 +446,8 @@ __call16_int(struct bregs *callregs, u16 offset)
 {
     callregs->code.offset = offset;
     if (!MODESEGMENT) {
+        // Keep buffered debug output ahead of output from 16bit code
+        debug_ring_drain();
         callregs->code.seg = SEG_BIOS;
         _farcall16((void*)callregs - Call16Data.ss * 16, Call16Data.ss);
         return;
@@ -624,6 +628,9 @@ check_irqs(void)
 void
 yield(void)
 {
+    if (!MODESEGMENT)
+        // Opportunistically send buffered debug output
+        debug_ring_drain();
     if (MODESEGMENT || !CONFIG_THREADS) {
         check_irqs();
         return;
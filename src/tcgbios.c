@@ -15,6 +15,7 @@
 #include "farptr.h" // MAKE_FLATPTR
 #include "fw/paravirt.h" // runningOnXen
 #include "hw/tpm_drivers.h" // tpm_drivers[]
+#include "list.h" // hlist_add
 #include "output.h" // dprintf
 #include "sha.h" // sha1, sha256, ...
 #include "std/acpi.h"  // RSDP_SIGNATURE, rsdt_descriptor
@@ -167,32 +168,27 @@ static const struct hash_parameters {
     u8  hashalg_flag;
     u8  hash_buffersize;
     const char *name;
-    void (*hashfunc)(const u8 *data, u32 length, u8 *hash);
 } hash_parameters[] = {
     {
         .hashalg = TPM2_ALG_SHA1,
         .hashalg_flag = TPM2_ALG_SHA1_FLAG,
         .hash_buffersize = SHA1_BUFSIZE,
         .name = "SHA1",
-        .hashfunc = sha1,
     }, {
         .hashalg = TPM2_ALG_SHA256,
         .hashalg_flag = TPM2_ALG_SHA256_FLAG,
         .hash_buffersize = SHA256_BUFSIZE,
         .name = "SHA256",
-        .hashfunc = sha256,
     }, {
         .hashalg = TPM2_ALG_SHA384,
         .hashalg_flag = TPM2_ALG_SHA384_FLAG,
         .hash_buffersize = SHA384_BUFSIZE,
         .name = "SHA384",
-        .hashfunc = sha384,
     }, {
         .hashalg = TPM2_ALG_SHA512,
         .hashalg_flag = TPM2_ALG_SHA512_FLAG,
         .hash_buffersize = SHA512_BUFSIZE,
         .name = "SHA512",
-        .hashfunc = sha512,
     }, {
         .hashalg = TPM2_ALG_SM3_256,
         .hashalg_flag = TPM2_ALG_SM3_256_FLAG,
@@ -264,18 +260,110 @@ tpm20_hashalg_flag_to_name(u8 hashalg_flag)
     return NULL;
 }
 
-static void tpm2_hash_data(u16 hashAlg, const u8 *data, u32 data_len, u8 *hash)
+// Hash state of one PCR bank
+struct tpm2_hash_bank {
+    u16 hashalg;
+    u8 *hash;
+    union {
+        struct sha1_ctx sha1;
+        struct sha256_ctx sha256;
+        struct sha512_ctx sha512;
+    };
+};
+
+// Hash states for hashing data into all active PCR banks in a single
+// pass.  They are too large for the stack of the INT 1Ah handler, so they
+// are only available during POST; afterwards the banks are hashed one
+// after the other.
+#define TPM2_MAX_HASH_BANKS 4
+static struct tpm2_hash_bank *TPM2HashBanks;
+
+// Amount of data fed to each bank at a time while the data is in cache
+#define TPM2_HASH_CHUNK 4096
+
+// Set up the hash of a PCR bank that is to be calculated into 'hash'.
+// Returns 0 if the hash is not supported (and was filled with 0xff).
+static int
+tpm2_hash_setup(struct tpm2_hash_bank *bank, u16 hashAlg, u8 *hash)
 {
-    unsigned i;
+    switch (hashAlg) {
+    case TPM2_ALG_SHA1:
+    case TPM2_ALG_SHA256:
+    case TPM2_ALG_SHA384:
+    case TPM2_ALG_SHA512:
+        break;
+    default:
+        // Hash not supported - fill with 0xff
+        memset(hash, 0xff, tpm20_get_hash_buffersize(hashAlg));
+        return 0;
+    }
+    bank->hashalg = hashAlg;
+    bank->hash = hash;
+    return 1;
+}
 
-    for (i = 0; i < ARRAY_SIZE(hash_parameters); i++) {
-        if (hash_parameters[i].hashalg == hashAlg) {
-            if (hash_parameters[i].hashfunc) {
-                hash_parameters[i].hashfunc(data, data_len, hash);
-            } else {
-                memset(hash, 0xff, hash_parameters[i].hash_buffersize);
+// Hash the given data into all the given banks and store the results.
+// The hashes are started here so that every started hash is also
+// finished (the SHA extensions stay enabled until then).
+static void
+tpm2_hash_data(struct tpm2_hash_bank *banks, int count
+               , const u8 *data, u32 data_len)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        struct tpm2_hash_bank *bank = &banks[i];
+        switch (bank->hashalg) {
+        case TPM2_ALG_SHA1:
+            sha1_init(&bank->sha1);
+            break;
+        case TPM2_ALG_SHA256:
+            sha256_init(&bank->sha256);
+            break;
+        case TPM2_ALG_SHA384:
+            sha384_init(&bank->sha512);
+            break;
+        case TPM2_ALG_SHA512:
+            sha512_init(&bank->sha512);
+            break;
+        }
+    }
+
+    while (data_len) {
+        u32 len = data_len > TPM2_HASH_CHUNK ? TPM2_HASH_CHUNK : data_len;
+        for (i = 0; i < count; i++) {
+            struct tpm2_hash_bank *bank = &banks[i];
+            switch (bank->hashalg) {
+            case TPM2_ALG_SHA1:
+                sha1_update(&bank->sha1, data, len);
+                break;
+            case TPM2_ALG_SHA256:
+                sha256_update(&bank->sha256, data, len);
+                break;
+            default:
+                sha512_update(&bank->sha512, data, len);
+                break;
             }
         }
+        data += len;
+        data_len -= len;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct tpm2_hash_bank *bank = &banks[i];
+        switch (bank->hashalg) {
+        case TPM2_ALG_SHA1:
+            sha1_final(&bank->sha1, bank->hash);
+            break;
+        case TPM2_ALG_SHA256:
+            sha256_final(&bank->sha256, bank->hash);
+            break;
+        case TPM2_ALG_SHA384:
+            sha384_final(&bank->sha512, bank->hash);
+            break;
+        case TPM2_ALG_SHA512:
+            sha512_final(&bank->sha512, bank->hash);
+            break;
+        }
     }
 }
 
@@ -354,28 +442,29 @@ tpm20_write_EfiSpecIdEventStruct(void)
 }
 
 /*
- * Build the TPM2 tpm2_digest_values data structure from the given hash.
- * Follow the PCR bank configuration of the TPM and write the same hash
- * in either truncated or zero-padded form in the areas of all the other
- * hashes. For example, write the sha1 hash in the area of the sha256
- * hash and fill the remaining bytes with zeros. Or truncate the sha256
- * hash when writing it in the area of the sha1 hash.
+ * Build the TPM2 tpm2_digest_values data structure for the given data.
+ * Follow the PCR bank configuration of the TPM and calculate the hash
+ * of every active bank. During POST the data is read only once - it is
+ * fed to all the bank hashes together. The structure is built in big endian
+ * format for the TPM; use tpm20_digest_to_log() to convert it to the
+ * little endian format of the log.
  *
  * le: the log entry to build the digest in
  * hashdata: the data to hash
  * hashdata_len: the length of the hashdata
- * bigEndian: whether to build in big endian format for the TPM or
- *            little endian for the log
  *
  * Returns the digest size; -1 on fatal error
  */
 static int
 tpm20_build_digest(struct tpm_log_entry *le,
-                   const u8 *hashdata, u32 hashdata_len, int bigEndian)
+                   const u8 *hashdata, u32 hashdata_len)
 {
     if (!tpm20_pcr_selection)
         return -1;
 
+    struct tpm2_hash_bank onebank, *banks = TPM2HashBanks;
+    int bankcount = 0;
+
     struct tpms_pcr_selection *sel = tpm20_pcr_selection->selections;
     void *nsel, *end = (void*)tpm20_pcr_selection + tpm20_pcr_selection_size;
     void *dest = le->hdr.digest + sizeof(struct tpm2_digest_values);
@@ -408,13 +497,18 @@ tpm20_build_digest(struct tpm_log_entry *le,
             return -1;
         }
 
-        if (bigEndian)
-            v->hashAlg = sel->hashAlg;
-        else
-            v->hashAlg = be16_to_cpu(sel->hashAlg);
-
-        tpm2_hash_data(be16_to_cpu(sel->hashAlg), hashdata, hashdata_len,
-                       v->hash);
+        v->hashAlg = sel->hashAlg;
+        if (banks && bankcount >= TPM2_MAX_HASH_BANKS) {
+            dprintf(DEBUG_tcg, "Too many active PCR banks\n");
+            return -1;
+        }
+        struct tpm2_hash_bank *bank = banks ? &banks[bankcount] : &onebank;
+        if (tpm2_hash_setup(bank, be16_to_cpu(sel->hashAlg), v->hash)) {
+            if (banks)
+                bankcount++;
+            else
+                tpm2_hash_data(bank, 1, hashdata, hashdata_len);
+        }
 
         dest += sizeof(*v) + hsize;
         sel = nsel;
@@ -427,15 +521,36 @@ tpm20_build_digest(struct tpm_log_entry *le,
         return -1;
     }
 
+    if (banks)
+        tpm2_hash_data(banks, bankcount, hashdata, hashdata_len);
+
     struct tpm2_digest_values *v = (void*)le->hdr.digest;
-    if (bigEndian)
-        v->count = cpu_to_be32(numAlgs);
-    else
-        v->count = numAlgs;
+    v->count = cpu_to_be32(numAlgs);
 
     return dest - (void*)le->hdr.digest;
 }
 
+/*
+ * Convert a tpm2_digest_values structure built by tpm20_build_digest()
+ * from the big endian format of the TPM to the little endian format of
+ * the log.
+ */
+static void
+tpm20_digest_to_log(struct tpm_log_entry *le)
+{
+    struct tpm2_digest_values *dv = (void*)le->hdr.digest;
+    u32 count = be32_to_cpu(dv->count);
+    void *dest = le->hdr.digest + sizeof(*dv);
+
+    dv->count = count;
+    while (count--) {
+        struct tpm2_digest_value *v = dest;
+        u16 hashAlg = be16_to_cpu(v->hashAlg);
+        v->hashAlg = hashAlg;
+        dest += sizeof(*v) + tpm20_get_hash_buffersize(hashAlg);
+    }
+}
+
 static int
 tpm12_build_digest(struct tpm_log_entry *le,
                    const u8 *hashdata, u32 hashdata_len)
@@ -453,18 +568,25 @@ tpm12_build_digest_direct(struct tpm_log_entry *le, const u8 *sha1)
 }
 
 static int
-tpm_build_digest(struct tpm_log_entry *le, const u8 *hashdata, u32 hashdata_len
-                 , int bigEndian)
+tpm_build_digest(struct tpm_log_entry *le, const u8 *hashdata, u32 hashdata_len)
 {
     switch (TPM_version) {
     case TPM_VERSION_1_2:
         return tpm12_build_digest(le, hashdata, hashdata_len);
     case TPM_VERSION_2:
-        return tpm20_build_digest(le, hashdata, hashdata_len, bigEndian);
+        return tpm20_build_digest(le, hashdata, hashdata_len);
     }
     return -1;
 }
 
+// Convert a digest built for the TPM to the format used in the log
+static void
+tpm_digest_to_log(struct tpm_log_entry *le)
+{
+    if (TPM_version == TPM_VERSION_2)
+        tpm20_digest_to_log(le);
+}
+
 
 /****************************************************************
  * TPM hardware command wrappers
@@ -990,6 +1112,94 @@ tpm_set_failure(void)
     TPM_working = 0;
 }
 
+/****************************************************************
+ * Deferred PCR extends
+ ****************************************************************/
+
+// During POST the PCR extends of measurements are sent to the TPM from a
+// background thread so that the TPM I/O overlaps with device init.  The
+// extends are issued in order and each log entry is only written once
+// its extend succeeded; tpm_extend_drain() waits for all queued extends
+// to complete.  It is called before anything else may talk to the TPM
+// (option roms, the INT 1Ah handler, tpm_prepboot()).  The queue is only
+// reachable through TPMExtendQueueFunc, which is set from tpm_setup()
+// until tpm_prepboot(), as it uses POST-only memory.
+struct tpm_extend_s {
+    struct hlist_node node;
+    int digest_len;
+    u32 event_length;
+    struct tpm_log_entry le;
+    u8 event[0];
+};
+
+static struct hlist_head TPMExtendQueue;
+static int TPMExtendThreadRunning;
+static int (*TPMExtendQueueFunc)(struct tpm_log_entry *le, int digest_len
+                                 , const char *event, u32 event_length);
+
+// Extend a PCR and then add the event to the log.
+static void
+tpm_extend_and_log(struct tpm_log_entry *le, int digest_len
+                   , const char *event, u32 event_length)
+{
+    int ret = tpm_extend(le, digest_len);
+    if (ret) {
+        tpm_set_failure();
+        return;
+    }
+    tpm_digest_to_log(le);
+    tpm_log_event(&le->hdr, digest_len, event, event_length);
+}
+
+static void
+tpm_extend_thread(void *data)
+{
+    while (TPMExtendQueue.first) {
+        struct tpm_extend_s *te = container_of(
+            TPMExtendQueue.first, struct tpm_extend_s, node);
+        if (tpm_is_working())
+            tpm_extend_and_log(&te->le, te->digest_len
+                               , (void*)te->event, te->event_length);
+        hlist_del(&te->node);
+        free(te);
+    }
+    TPMExtendThreadRunning = 0;
+}
+
+// Queue a PCR extend and log event; returns -1 if it must be done
+// synchronously.
+static int
+tpm_extend_queue(struct tpm_log_entry *le, int digest_len
+                 , const char *event, u32 event_length)
+{
+    struct tpm_extend_s *te = malloc_tmp(sizeof(*te) + event_length);
+    if (!te)
+        return -1;
+    te->digest_len = digest_len;
+    te->event_length = event_length;
+    memcpy(&te->le, le, sizeof(te->le));
+    memcpy(te->event, event, event_length);
+
+    struct hlist_node **pprev = &TPMExtendQueue.first;
+    while (*pprev)
+        pprev = &(*pprev)->next;
+    hlist_add(&te->node, pprev);
+
+    if (!TPMExtendThreadRunning) {
+        TPMExtendThreadRunning = 1;
+        run_thread(tpm_extend_thread, NULL);
+    }
+    return 0;
+}
+
+// Wait for all queued PCR extends to be sent to the TPM and logged.
+void
+tpm_extend_drain(void)
+{
+    while (TPMExtendThreadRunning)
+        yield();
+}
+
 /*
  * Add a measurement to the log; the data at data_seg:data/length are
  * appended to the TCG_PCClientPCREventStruct
@@ -1014,16 +1224,14 @@ tpm_add_measurement_to_log(u32 pcrindex, u32 event_type,
         .hdr.pcrindex = pcrindex,
         .hdr.eventtype = event_type,
     };
-    int digest_len = tpm_build_digest(&le, hashdata, hashdata_length, 1);
+    int digest_len = tpm_build_digest(&le, hashdata, hashdata_length);
     if (digest_len < 0)
         return;
-    int ret = tpm_extend(&le, digest_len);
-    if (ret) {
-        tpm_set_failure();
+    if (TPMExtendQueueFunc
+        && !TPMExtendQueueFunc(&le, digest_len, event, event_length))
         return;
-    }
-    tpm_build_digest(&le, hashdata, hashdata_length, 0);
-    tpm_log_event(&le.hdr, digest_len, event, event_length);
+    tpm_extend_drain();
+    tpm_extend_and_log(&le, digest_len, event, event_length);
 }
 
 // Add an EV_ACTION measurement to the list of measurements
@@ -1229,6 +1437,14 @@ tpm_setup(void)
     if (runningOnXen())
         return;
 
+    // Skip locality activation for the commands sent during POST
+    tpmhw_hold_locality(1);
+    if (CONFIG_THREADS)
+        TPMExtendQueueFunc = tpm_extend_queue;
+    if (TPM_version == TPM_VERSION_2)
+        TPM2HashBanks = malloc_tmp(sizeof(*TPM2HashBanks)
+                                   * TPM2_MAX_HASH_BANKS);
+
     ret = tpm_startup();
     if (ret)
         return;
@@ -1267,6 +1483,8 @@ tpm_prepboot(void)
     if (!CONFIG_TCGBIOS)
         return;
 
+    tpm_extend_drain();
+
     switch (TPM_version) {
     case TPM_VERSION_1_2:
         if (TPM_has_physical_presence)
@@ -1280,14 +1498,30 @@ tpm_prepboot(void)
 
     tpm_add_action(4, "Calling INT 19h");
     tpm_add_event_separators();
+    tpm_extend_drain();
+    TPMExtendQueueFunc = NULL;
+    free(TPM2HashBanks);
+    TPM2HashBanks = NULL;
+
+    tpmhw_hold_locality(0);
 }
 
+// Amount of an option rom copied before hashing it while still in cache
+#define TPM_ROM_COPY_CHUNK 4096
+
 /*
- * Add measurement to the log about an option rom
+ * Copy an option rom to its final location and add a measurement to the
+ * log about it. The rom is hashed in the same pass as it is copied.
  */
 void
-tpm_option_rom(const void *addr, u32 len)
+tpm_copy_option_rom(void *dest, const void *src, u32 len)
 {
+    if (!tpm_is_working() || (dest > src && dest < src + len)) {
+        // Can't hash in chunks if the forward copy would overwrite the rom
+        if (dest != src)
+            memmove(dest, src, len);
+        src = dest;
+    }
     if (!tpm_is_working())
         return;
 
@@ -1295,7 +1529,18 @@ tpm_option_rom(const void *addr, u32 len)
         .eventid = 7,
         .eventdatasize = sizeof(u16) + sizeof(u16) + SHA1_BUFSIZE,
     };
-    sha1((const u8 *)addr, len, pcctes.digest);
+    struct sha1_ctx ctx;
+    sha1_init(&ctx);
+    u32 pos;
+    for (pos = 0; pos < len; pos += TPM_ROM_COPY_CHUNK) {
+        u32 count = len - pos;
+        if (count > TPM_ROM_COPY_CHUNK)
+            count = TPM_ROM_COPY_CHUNK;
+        if (dest != src)
+            memmove(dest + pos, src + pos, count);
+        sha1_update(&ctx, dest + pos, count);
+    }
+    sha1_final(&ctx, pcctes.digest);
     tpm_add_measurement_to_log(2,
                                EV_EVENT_TAG,
                                (const char *)&pcctes, sizeof(pcctes),
@@ -1658,6 +1903,9 @@ tpm_interrupt_handler32(struct bregs *regs)
 
     set_cf(regs, 0);
 
+    // Let queued extends reach the TPM before any request of the caller
+    tpm_extend_drain();
+
     if (TPM_interface_shutdown && regs->al) {
         regs->eax = TCG_INTERFACE_SHUTDOWN;
         return;
@@ -12,7 +12,8 @@ void tpm_s3_resume(void);
 void tpm_add_bcv(u32 bootdrv, const u8 *addr, u32 length);
 void tpm_add_cdrom(u32 bootdrv, const u8 *addr, u32 length);
 void tpm_add_cdrom_catalog(const u8 *addr, u32 length);
-void tpm_option_rom(const void *addr, u32 len);
+void tpm_copy_option_rom(void *dest, const void *src, u32 len);
+void tpm_extend_drain(void);
 int tpm_can_show_menu(void);
 void tpm_menu(void);
 
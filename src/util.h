@@ -27,6 +27,7 @@ void boot_add_cd(struct drive_s *drive_g, const char *desc, int prio);
 void boot_add_cbfs(void *data, const char *desc, int prio);
 void interactive_bootmenu(void);
 void bcv_prepboot(void);
+int bootorder_present(void);
 u8 is_bootprio_strict(void);
 struct pci_device;
 int bootprio_find_pci_device(struct pci_device *pci);
@@ -39,6 +40,7 @@ int bootprio_find_pci_rom(struct pci_device *pci, int instance);
 int bootprio_find_named_rom(const char *name, int instance);
 struct usbdevice_s;
 int bootprio_find_usb(struct usbdevice_s *usbdev, int lun);
+char *build_usbdev_path(char *buf, int max, struct usbdevice_s *usbdev);
 int get_keystroke_full(int msec);
 int get_keystroke(int msec);
 struct chs_s;
@@ -113,6 +115,8 @@ void coreboot_platform_setup(void);
 void cbfs_payload_setup(void);
 void coreboot_preinit(void);
 void coreboot_cbfs_init(void);
+struct romfile_s;
+void *cbfs_romfile_map(struct romfile_s *file);
 struct cb_header;
 void *find_cb_subtable(struct cb_header *cbh, u32 tag);
 struct cb_header *find_cb_table(void);
@@ -174,6 +178,7 @@ void floppy_tick(void);
 
 // hw/ramdisk.c
 void ramdisk_setup(void);
+void ramdisk_prepboot(void);
 int ramdisk_process_op(struct disk_op_s *op);
 
 // hw/sdcard.c
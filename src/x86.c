@@ -21,3 +21,26 @@ cpuid(u32 index, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
     else
         __cpuid(index, eax, ebx, ecx, edx);
 }
+
+// Enable the SSE instructions for temporary use.  SSE is only enabled
+// when nothing else has enabled it (and thus nothing can have live state
+// in the xmm registers).  The caller must have verified cpu support for
+// the instructions it uses.  Returns the cr4 value to pass to
+// sse_leave(), or zero if SSE can't be used.
+u32
+sse_enter(void)
+{
+    if (cr0_read() & (CR0_TS | CR0_EM))
+        return 0;
+    u32 cr4 = cr4_read();
+    if (cr4 & CR4_OSFXSR)
+        return 0;
+    cr4_write(cr4 | CR4_OSFXSR);
+    return cr4 | CR4_OSFXSR;
+}
+
+void
+sse_leave(u32 cr4)
+{
+    cr4_write(cr4 & ~CR4_OSFXSR);
+}
@@ -12,8 +12,13 @@
 #define CR0_PG (1<<31) // Paging
 #define CR0_CD (1<<30) // Cache disable
 #define CR0_NW (1<<29) // Not Write-through
+#define CR0_TS (1<<3)  // Task switched
+#define CR0_EM (1<<2)  // Emulation
 #define CR0_PE (1<<0)  // Protection enable
 
+// CR4 flags
+#define CR4_OSFXSR (1<<9) // OS support for FXSAVE/FXRSTOR and SSE
+
 // PORT_A20 bitdefs
 #define PORT_A20 0x0092
 #define A20_ENABLE_BIT 0x02
@@ -68,6 +73,7 @@ static inline void wbinvd(void)
 #define CPUID_MSR (1 << 5)
 #define CPUID_APIC (1 << 9)
 #define CPUID_MTRR (1 << 12)
+#define CPUID_SSE2 (1 << 26)
 #define CPUID_X2APIC (1 << 21)
 static inline void __cpuid(u32 index, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
 {
@@ -75,6 +81,13 @@ static inline void __cpuid(u32 index, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
         : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
         : "0" (index));
 }
+static inline void __cpuid_count(u32 index, u32 subindex
+                                 , u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
+{
+    asm("cpuid"
+        : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+        : "0" (index), "2" (subindex));
+}
 
 static inline u32 cr0_read(void) {
     u32 cr0;
@@ -87,6 +100,14 @@ static inline void cr0_write(u32 cr0) {
 static inline void cr0_mask(u32 off, u32 on) {
     cr0_write((cr0_read() & ~off) | on);
 }
+static inline u32 cr4_read(void) {
+    u32 cr4;
+    asm("movl %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+static inline void cr4_write(u32 cr4) {
+    asm("movl %0, %%cr4" : : "r"(cr4));
+}
 static inline u16 cr0_vm86_read(void) {
     u16 cr0;
     asm("smsww %0" : "=r"(cr0));
@@ -278,6 +299,8 @@ static inline u8 set_a20(u8 cond) {
 
 // x86.c
 void cpuid(u32 index, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx);
+u32 sse_enter(void);
+void sse_leave(u32 cr4);
 
 #endif // !__ASSEMBLY__
 
@@ -11,7 +11,7 @@
 #include "string.h" // memset16_far
 #include "util.h" // find_cb_table
 #include "vgabios.h" // SET_VGA
-#include "vgafb.h" // handle_gfx_op
+#include "vgafb.h" // handle_gfx_op, vgafb_shadow_text_init
 #include "vgautil.h" // VBE_total_memory
 #include "svgamodes.h" // svga_modes
 
@@ -137,7 +137,8 @@ cbvga_set_mode(struct vgamode_s *vmode_g, int flags)
      * too, and GO_MEMSET uses that.
      */
     u8 extra_stack = GET_BDA_EXT(flags) & BF_EXTRA_STACK;
-    MASK_BDA_EXT(flags, BF_EMULATE_TEXT, emul ? BF_EMULATE_TEXT : 0);
+    MASK_BDA_EXT(flags, BF_EMULATE_TEXT | BF_SHADOW_TEXT
+                 , emul ? BF_EMULATE_TEXT : 0);
     if (!(flags & MF_NOCLEARMEM)) {
         if (GET_GLOBAL(CBmodeinfo.memmodel) == MM_TEXT) {
             memset16_far(SEG_CTEXT, (void*)0, 0x0720, 80*25*2);
@@ -151,6 +152,8 @@ cbvga_set_mode(struct vgamode_s *vmode_g, int flags)
             op.ylen = GET_GLOBAL(CBmodeinfo.height);
             op.op = GO_MEMSET;
             handle_gfx_op(&op);
+            if (emul)
+                vgafb_shadow_text_init(vmode_g);
         }
     }
     return 0;
@@ -15,30 +15,91 @@
 #include "vgahw.h" // vgahw_get_linelength
 #include "vgautil.h" // VBE_framebuffer
 
+// Copy memory within the framebuffer using 32bit accesses (which are
+// much faster than byte accesses on most video hardware).
+static inline void
+memcpy32_far(u16 seg, void *dst, void *src, u32 len)
+{
+    SET_SEG(ES, seg);
+    u16 bkup_ds;
+    u32 dwords = len / 4;
+    asm volatile(
+        "movw %%ds, %w0\n"
+        "movw %w5, %%ds\n"
+        "rep movsl (%%si),%%es:(%%di)\n"
+        "movl %4, %%ecx\n"
+        "rep movsb (%%si),%%es:(%%di)\n"
+        "movw %w0, %%ds"
+        : "=&r"(bkup_ds), "+c"(dwords), "+S"(src), "+D"(dst)
+        : "r"(len & 3), "r"(seg), "m" (__segment_ES)
+        : "cc", "memory");
+}
+
+// Fill framebuffer memory with a repeating 32bit pattern.
+static inline void
+memset32_far(u16 seg, void *dst, u32 val, u32 len)
+{
+    SET_SEG(ES, seg);
+    u32 dwords = len / 4;
+    asm volatile(
+        "rep stosl %%es:(%%di)\n"
+        "movl %3, %%ecx\n"
+        "rep stosb %%es:(%%di)"
+        : "+c"(dwords), "+D"(dst), "+a"(val)
+        : "r"(len & 3), "m" (__segment_ES)
+        : "cc", "memory");
+}
+
 static inline void
 memmove_stride(u16 seg, void *dst, void *src, int copylen, int stride, int lines)
 {
+    if (copylen == stride) {
+        // The lines are contiguous - move them all at once.
+        u32 len = copylen * lines;
+        if (src > dst || dst - src >= len) {
+            memcpy32_far(seg, dst, src, len);
+            return;
+        }
+        // Overlapping move up - copy from the end in non-overlapping chunks
+        u32 chunk = dst - src;
+        while (len) {
+            u32 n = len < chunk ? len : chunk;
+            len -= n;
+            memcpy32_far(seg, dst + len, src + len, n);
+        }
+        return;
+    }
     if (src < dst) {
         dst += stride * (lines - 1);
         src += stride * (lines - 1);
         stride = -stride;
     }
     for (; lines; lines--, dst+=stride, src+=stride)
-        memcpy_far(seg, dst, seg, src, copylen);
+        memcpy32_far(seg, dst, src, copylen);
 }
 
 static inline void
 memset_stride(u16 seg, void *dst, u8 val, int setlen, int stride, int lines)
 {
+    u32 val32 = val * 0x01010101;
+    if (setlen == stride) {
+        memset32_far(seg, dst, val32, setlen * lines);
+        return;
+    }
     for (; lines; lines--, dst+=stride)
-        memset_far(seg, dst, val, setlen);
+        memset32_far(seg, dst, val32, setlen);
 }
 
 static inline void
 memset16_stride(u16 seg, void *dst, u16 val, int setlen, int stride, int lines)
 {
+    u32 val32 = val | (val << 16);
+    if (setlen == stride) {
+        memset32_far(seg, dst, val32, setlen * lines);
+        return;
+    }
     for (; lines; lines--, dst+=stride)
-        memset16_far(seg, dst, val, setlen);
+        memset32_far(seg, dst, val32, setlen);
 }
 
 
@@ -186,8 +247,13 @@ gfx_packed(struct gfx_op *op)
  * Direct framebuffers in high mem
  ****************************************************************/
 
-// Use int 1587 call to copy memory to/from the framebuffer.
-void memcpy_high(void *dest, void *src, u32 len)
+// Maximum length of a single int 1587 copy (0x8000 words).
+#define HIGH_COPY_MAX (64*1024)
+
+// Use int 1587 call to copy memory to/from the framebuffer.  The bios
+// copies with 32bit moves when the length is a multiple of four.
+static void
+memcpy_high_chunk(void *dest, void *src, u32 len)
 {
     u64 gdt[6];
     gdt[2] = GDT_DATA | GDT_LIMIT(0xfffff) | GDT_BASE((u32)src);
@@ -210,9 +276,41 @@ void memcpy_high(void *dest, void *src, u32 len)
         : : "cc", "memory");
 }
 
+// Copy memory to/from the framebuffer.  The copy is done in ascending
+// order, so it may be used to replicate a pattern to a higher address.
+void memcpy_high(void *dest, void *src, u32 len)
+{
+    while (len > HIGH_COPY_MAX) {
+        memcpy_high_chunk(dest, src, HIGH_COPY_MAX);
+        dest += HIGH_COPY_MAX;
+        src += HIGH_COPY_MAX;
+        len -= HIGH_COPY_MAX;
+    }
+    memcpy_high_chunk(dest, src, len);
+}
+
 static void
 memmove_stride_high(void *dst, void *src, int copylen, int stride, int lines)
 {
+    if (copylen == stride) {
+        // The lines are contiguous - move them with as few calls as
+        // possible as each int 1587 call is a protected mode round trip.
+        u32 len = copylen * lines;
+        if (src > dst || dst - src >= len) {
+            memcpy_high(dst, src, len);
+            return;
+        }
+        // Overlapping move up - copy from the end in non-overlapping chunks
+        u32 chunk = dst - src;
+        if (chunk > HIGH_COPY_MAX)
+            chunk = HIGH_COPY_MAX;
+        while (len) {
+            u32 n = len < chunk ? len : chunk;
+            len -= n;
+            memcpy_high(dst + len, src + len, n);
+        }
+        return;
+    }
     if (src < dst) {
         dst += stride * (lines - 1);
         src += stride * (lines - 1);
@@ -294,6 +392,13 @@ gfx_direct(struct gfx_op *op)
             *(u32*)&data[i*bypp] = color;
         memcpy_high(dest_far, MAKE_FLATPTR(GET_SEG(SS), data), bypp * 8);
         memcpy_high(dest_far + bypp * 8, dest_far, op->xlen * bypp - bypp * 8);
+        if (op->xlen * bypp == op->linelength) {
+            // The lines are contiguous - replicate the first line in one go
+            if (op->ylen > 1)
+                memcpy_high(dest_far + op->linelength, dest_far
+                            , op->linelength * (op->ylen - 1));
+            break;
+        }
         for (i=1; i < op->ylen; i++)
             memcpy_high(dest_far + op->linelength * i
                         , dest_far, op->xlen * bypp);
@@ -513,6 +618,10 @@ vgafb_write_pixel(u8 color, u16 x, u16 y)
     op.op = GO_READ8;
     handle_gfx_op(&op);
 
+    if (CONFIG_VGA_SHADOW_TEXT)
+        // The shadow text buffer no longer matches the screen
+        MASK_BDA_EXT(flags, BF_SHADOW_TEXT, 0);
+
     int usexor = color & 0x80 && GET_GLOBAL(vmode_g->depth) < 8;
     if (usexor)
         op.pixels[x & 0x07] ^= color & 0x7f;
@@ -541,6 +650,38 @@ vgafb_read_pixel(u16 x, u16 y)
 }
 
 
+/****************************************************************
+ * Shadow text buffer
+ ****************************************************************/
+
+// Return the offset of a character cell in the shadow text buffer (or
+// -1 if the shadow buffer is not in use).
+static int
+shadow_text_offset(struct cursorpos cp)
+{
+    if (!CONFIG_VGA_SHADOW_TEXT || !(GET_BDA_EXT(flags) & BF_SHADOW_TEXT))
+        return -1;
+    int cols = GET_BDA(video_cols);
+    if (cp.x >= cols || cp.y > GET_BDA(video_rows))
+        return -1;
+    return (cp.y * cols + cp.x) * 2;
+}
+
+// Start tracking the contents of a freshly cleared emulated text screen.
+void
+vgafb_shadow_text_init(struct vgamode_s *vmode_g)
+{
+    if (!CONFIG_VGA_SHADOW_TEXT || !GET_GLOBAL(ShadowTextSeg))
+        return;
+    u32 cols = GET_GLOBAL(vmode_g->width) / GET_GLOBAL(vmode_g->cwidth);
+    u32 rows = GET_GLOBAL(vmode_g->height) / GET_GLOBAL(vmode_g->cheight);
+    if (cols * rows * 2 > GET_GLOBAL(ShadowTextSize))
+        return;
+    memset16_far(GET_GLOBAL(ShadowTextSeg), (void*)0, 0x0720, cols * rows * 2);
+    MASK_BDA_EXT(flags, 0, BF_SHADOW_TEXT);
+}
+
+
 /****************************************************************
  * Text ops
  ****************************************************************/
@@ -564,6 +705,13 @@ vgafb_move_chars(struct cursorpos dest, struct cursorpos movesize, int lines)
 
     if (GET_GLOBAL(vmode_g->memmodel) != MM_TEXT) {
         gfx_move_chars(vmode_g, dest, movesize, lines);
+        int offset = shadow_text_offset(dest);
+        if (offset >= 0) {
+            int stride = GET_BDA(video_cols) * 2;
+            memmove_stride(GET_GLOBAL(ShadowTextSeg), (void*)offset
+                           , (void*)offset + lines * stride
+                           , movesize.x * 2, stride, movesize.y);
+        }
         return;
     }
 
@@ -584,6 +732,11 @@ vgafb_clear_chars(struct cursorpos win, struct cursorpos winsize
 
     if (GET_GLOBAL(vmode_g->memmodel) != MM_TEXT) {
         gfx_clear_chars(vmode_g, win, winsize, ca);
+        int offset = shadow_text_offset(win);
+        if (offset >= 0)
+            memset16_stride(GET_GLOBAL(ShadowTextSeg), (void*)offset
+                            , (ca.attr << 8) | ' ', winsize.x * 2
+                            , GET_BDA(video_cols) * 2, winsize.y);
         return;
     }
 
@@ -630,6 +783,21 @@ vgafb_write_char(struct cursorpos cp, struct carattr ca)
         return;
 
     if (GET_GLOBAL(vmode_g->memmodel) != MM_TEXT) {
+        int offset = shadow_text_offset(cp);
+        if (offset >= 0) {
+            u16 seg = GET_GLOBAL(ShadowTextSeg), *cell_far = (void*)offset;
+            u16 oldcell = GET_FARVAR(seg, *cell_far);
+            if (!ca.use_attr) {
+                // Keep the colors of the cell being overwritten
+                ca.attr = oldcell >> 8;
+                ca.use_attr = 1;
+            }
+            u16 cell = (ca.attr << 8) | ca.car;
+            if (cell == oldcell)
+                // Cell unchanged - no need to render it again
+                return;
+            SET_FARVAR(seg, *cell_far, cell);
+        }
         gfx_write_char(vmode_g, cp, ca);
         return;
     }
@@ -651,8 +819,13 @@ vgafb_read_char(struct cursorpos cp)
     if (!vmode_g)
         return (struct carattr){0, 0, 0};
 
-    if (GET_GLOBAL(vmode_g->memmodel) != MM_TEXT)
-        return gfx_read_char(vmode_g, cp);
+    if (GET_GLOBAL(vmode_g->memmodel) != MM_TEXT) {
+        int offset = shadow_text_offset(cp);
+        if (offset < 0)
+            return gfx_read_char(vmode_g, cp);
+        u16 v = GET_FARVAR(GET_GLOBAL(ShadowTextSeg), *(u16*)offset);
+        return (struct carattr){v, v>>8, 0};
+    }
 
     u16 *dest_far = text_address(cp);
     u16 v = GET_FARVAR(GET_GLOBAL(vmode_g->sstart), *dest_far);
@@ -32,6 +32,7 @@ struct carattr {
 void memcpy_high(void *dest, void *src, u32 len);
 void init_gfx_op(struct gfx_op *op, struct vgamode_s *vmode_g);
 void handle_gfx_op(struct gfx_op *op);
+void vgafb_shadow_text_init(struct vgamode_s *vmode_g);
 void *text_address(struct cursorpos cp);
 void vgafb_scroll(struct cursorpos win, struct cursorpos winsize
                   , int lines, struct carattr ca);
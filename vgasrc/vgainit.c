@@ -98,6 +98,30 @@ allocate_extra_stack(void)
     return;
 }
 
+u16 ShadowTextSeg VAR16, ShadowTextSize VAR16;
+
+static void
+allocate_shadow_text(void)
+{
+    if (!CONFIG_VGA_SHADOW_TEXT)
+        return;
+    struct vgamode_s *vmode_g = vgahw_find_mode(0x03);
+    if (!vmode_g || GET_GLOBAL(vmode_g->memmodel) == MM_TEXT)
+        return;
+    u32 size = ((GET_GLOBAL(vmode_g->width) / GET_GLOBAL(vmode_g->cwidth))
+                * (GET_GLOBAL(vmode_g->height) / GET_GLOBAL(vmode_g->cheight))
+                * 2);
+    if (size >= 64*1024)
+        return;
+    u32 res = allocate_pmm(ALIGN(size, 16), 0, 0);
+    if (!res)
+        return;
+    dprintf(1, "VGA shadow text buffer (%d bytes) allocated at %x\n"
+            , size, res);
+    SET_VGA(ShadowTextSeg, res >> 4);
+    SET_VGA(ShadowTextSize, size);
+}
+
 
 /****************************************************************
  * Timer hook
@@ -189,6 +213,8 @@ vga_post(struct bregs *regs)
 
     allocate_extra_stack();
 
+    allocate_shadow_text();
+
     hook_timer_irq();
 
     SET_VGA(HaveRunInit, 1);
@@ -102,6 +102,7 @@ extern u8 vgafont16alt[];
 // vgainit.c
 extern int VgaBDF;
 extern int HaveRunInit;
+extern u16 ShadowTextSeg, ShadowTextSize;
 u32 allocate_pmm(u32 size, int highmem, int aligned);
 
 // vgaversion.c